@@ -0,0 +1,95 @@
+#ifndef CHANGEPOINT_HPP
+#define CHANGEPOINT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace nettool {
+
+// Level shifts of the round trip time of a target, online.
+//
+// Samples are taken as log(rtt), so a shift is relative and one threshold
+// fits a LAN and an intercontinental path. An EWMA gives the baseline and
+// the mean absolute deviation its scale; each sample becomes the residual
+// z = (x - baseline) / scale, clipped so a single spike cannot cross the
+// threshold. Two one-sided CUSUMs accumulate the residuals beyond a slack k:
+//   S+ = max(0, S+ + z - k)     S- = max(0, S- - z - k)
+// When one exceeds h the level has changed. The new baseline is the mean of
+// the samples since that CUSUM last left zero, and both restart. A sample
+// costs a handful of arithmetic operations and the state is a few words.
+class change_detector {
+public:
+  struct change {
+    bool up;
+    // Levels before and after, nanoseconds
+    double before;
+    double after;
+    // Samples the shift took to detect
+    std::uint32_t delay;
+  };
+
+  static constexpr double alpha = 1.0 / 64;
+  static constexpr double slack = 1;
+  static constexpr double threshold = 8;
+  static constexpr double clip = 4;
+  // Deviations below 1% are taken as 1%, a quiet path is not that quiet
+  static constexpr double min_scale = 0.01;
+  enum { warmup = 16 };
+
+  // Return true and fill c if the sample completes a change
+  bool update(std::uint64_t rtt, change& c) {
+    double x = std::log(static_cast<double>(std::max<std::uint64_t>(rtt, 1)));
+    ++samples_;
+    if (samples_ <= warmup) {
+      // Plain mean and deviation until the EWMA has something to start from
+      double d = x - baseline_;
+      baseline_ += d / samples_;
+      scale_ += (std::fabs(x - baseline_) - scale_) / samples_;
+      return false;
+    }
+
+    double s = std::max(scale_, min_scale);
+    double z = std::min(std::max((x - baseline_) / s, -clip), clip);
+    if (up_ == 0) up_sum_ = up_count_ = 0;
+    if (down_ == 0) down_sum_ = down_count_ = 0;
+    up_ = std::max(0.0, up_ + z - slack);
+    down_ = std::max(0.0, down_ - z - slack);
+    if (up_ > 0) { up_sum_ += x; ++up_count_; }
+    if (down_ > 0) { down_sum_ += x; ++down_count_; }
+
+    if (up_ > threshold || down_ > threshold) {
+      c.up = up_ > threshold;
+      c.before = std::exp(baseline_);
+      baseline_ = c.up ? up_sum_ / up_count_ : down_sum_ / down_count_;
+      c.after = std::exp(baseline_);
+      c.delay = c.up ? up_count_ : down_count_;
+      up_ = down_ = 0;
+      ++changes_;
+      return true;
+    }
+    baseline_ += alpha * (x - baseline_);
+    scale_ += alpha * (std::fabs(x - baseline_) - scale_);
+    return false;
+  }
+
+  std::uint32_t changes() const { return changes_; }
+  // Current level in nanoseconds
+  double baseline() const { return samples_ ? std::exp(baseline_) : 0; }
+
+private:
+  std::uint64_t samples_ = 0;
+  double baseline_ = 0;
+  double scale_ = 0;
+  double up_ = 0;
+  double down_ = 0;
+  double up_sum_ = 0;
+  double down_sum_ = 0;
+  std::uint32_t up_count_ = 0;
+  std::uint32_t down_count_ = 0;
+  std::uint32_t changes_ = 0;
+};
+
+}
+
+#endif
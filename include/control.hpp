@@ -0,0 +1,148 @@
+#ifndef CONTROL_HPP
+#define CONTROL_HPP
+
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+
+namespace nettool {
+
+// Text of the reply to a control command, printed to like an output
+class control_reply {
+public:
+  template<typename S, typename... Args>
+  void print(const S& format, Args&&... args) {
+    fmt::format_to(std::back_inserter(buffer_), format, std::forward<Args>(args)...);
+  }
+
+  // The command failed, what was printed so far is dropped
+  void error(const std::string& message) {
+    buffer_.clear();
+    error_ = message;
+  }
+
+  const std::string& error() const { return error_; }
+  const fmt::memory_buffer& text() const { return buffer_; }
+
+private:
+  fmt::memory_buffer buffer_;
+  std::string error_;
+};
+
+// Line oriented commands on a Unix domain socket, served by the io_service
+// of the pinger so a command runs between two replies and needs no lock.
+//
+// Every line is a command. Its reply is the text printed by the handler
+// and a last line "ok", or a single line "error <message>".
+class control_server {
+public:
+  using protocol = boost::asio::local::stream_protocol;
+  using handler = std::function<void(const std::string& command, control_reply& reply)>;
+
+  enum { max_line = 4096 };
+
+  // A socket left over at path is replaced, anything else there is left
+  // alone: throw std::runtime_error
+  control_server(boost::asio::io_service& io_service, const std::string& path, handler h)
+      : io_service_(io_service), acceptor_(io_service), path_(path), handler_(std::move(h)) {
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0) {
+      if (!S_ISSOCK(st.st_mode))
+        throw std::runtime_error(path + " exists and is not a socket");
+      ::unlink(path.c_str());
+    }
+    protocol::endpoint endpoint(path);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    start_accept();
+  }
+
+  // Stop accepting and remove the socket
+  void close() {
+    boost::system::error_code ignored;
+    acceptor_.close(ignored);
+    ::unlink(path_.c_str());
+  }
+
+private:
+  class session : public std::enable_shared_from_this<session> {
+  public:
+    session(boost::asio::io_service& io_service, const handler& h)
+        : socket_(io_service), request_(max_line), handler_(h) {}
+
+    protocol::socket& socket() { return socket_; }
+
+    void start() {
+      boost::asio::async_read_until(socket_, request_, '\n',
+          boost::bind(&session::handle_line, shared_from_this(),
+            boost::asio::placeholders::error));
+    }
+
+  private:
+    void handle_line(const boost::system::error_code& ec) {
+      if (ec) return;
+      std::istream is(&request_);
+      std::string line;
+      std::getline(is, line);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+
+      control_reply reply;
+      try {
+        handler_(line, reply);
+      } catch (std::exception& e) {
+        reply.error(e.what());
+      }
+      buffer_.clear();
+      auto out = std::back_inserter(buffer_);
+      if (!reply.error().empty()) {
+        fmt::format_to(out, "error {}\n", reply.error());
+      } else {
+        buffer_.append(reply.text().data(), reply.text().data() + reply.text().size());
+        fmt::format_to(out, "ok\n");
+      }
+      boost::asio::async_write(socket_, boost::asio::buffer(buffer_.data(), buffer_.size()),
+          boost::bind(&session::handle_write, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handle_write(const boost::system::error_code& ec) {
+      if (!ec) start();
+    }
+
+    protocol::socket socket_;
+    boost::asio::streambuf request_;
+    const handler& handler_;
+    fmt::memory_buffer buffer_;
+  };
+
+  void start_accept() {
+    std::shared_ptr<session> s(new session(io_service_, handler_));
+    acceptor_.async_accept(s->socket(), boost::bind(&control_server::handle_accept,
+          this, s, boost::asio::placeholders::error));
+  }
+
+  void handle_accept(std::shared_ptr<session> s, const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) return;
+    if (!ec) s->start();
+    start_accept();
+  }
+
+  boost::asio::io_service& io_service_;
+  protocol::acceptor acceptor_;
+  std::string path_;
+  handler handler_;
+};
+
+}
+
+#endif
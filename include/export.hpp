@@ -0,0 +1,190 @@
+#ifndef EXPORT_HPP
+#define EXPORT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "histogram.hpp"
+#include "stats.hpp"
+
+namespace nettool {
+
+// Statistics of one target as exported
+struct target_record {
+  std::string name;
+  stats_summary stats;
+  latency_histogram histogram;
+};
+
+// Contents of a statistics file
+struct stats_export {
+  // Length of the measurement in microseconds, the longest one once merged
+  std::uint64_t duration = 0;
+  std::vector<target_record> records;
+};
+
+// Binary statistics file, mergeable across instances.
+//
+// All integers are little endian, doubles are stored by their bit pattern:
+//
+//   char[8]   magic "NTSTATS\0"
+//   u32       version
+//   u32, u32  SubBits and MaxBits of the latency histogram
+//   u64       duration of the measurement (us)
+//   u64       number of targets
+//   per target:
+//     u16, char[]       name length and name, cut at 65535 bytes
+//     u64 x 6           sent, received, lost, rtt min, rtt max, rtt sum (ns)
+//     f64 x 2           rtt mean and sum of squared deviations (ns)
+//     u32               number of non-empty buckets
+//     (u16, u64)[]      bucket index and count
+//
+// Counters and histograms add up exactly, so merging the files of several
+// shards gives the same summary as a single instance would have.
+class stats_file {
+public:
+  static constexpr char magic[8] = {'N', 'T', 'S', 'T', 'A', 'T', 'S', '\0'};
+  enum { version = 1 };
+
+  static void write(std::ostream& os, const stats_export& e) {
+    os.write(magic, sizeof(magic));
+    put<std::uint32_t>(os, version);
+    put<std::uint32_t>(os, sub_bits);
+    put<std::uint32_t>(os, max_bits);
+    put<std::uint64_t>(os, e.duration);
+    put<std::uint64_t>(os, e.records.size());
+    for (const auto& r : e.records) {
+      std::size_t length = std::min<std::size_t>(r.name.size(), 0xFFFF);
+      put<std::uint16_t>(os, length);
+      os.write(r.name.data(), length);
+      const stats_summary& s = r.stats;
+      for (std::uint64_t v : {s.sent, s.received, s.lost, s.rtt_min, s.rtt_max, s.rtt_sum})
+        put<std::uint64_t>(os, v);
+      put_double(os, s.rtt_mean);
+      put_double(os, s.rtt_m2);
+      const auto* counts = r.histogram.counts();
+      std::uint32_t used = 0;
+      for (int i = 0; i < latency_histogram::bucket_count; ++i)
+        used += counts[i] != 0;
+      put<std::uint32_t>(os, used);
+      for (int i = 0; i < latency_histogram::bucket_count; ++i) {
+        if (counts[i] == 0) continue;
+        put<std::uint16_t>(os, i);
+        put<std::uint64_t>(os, counts[i]);
+      }
+    }
+  }
+
+  // Throw std::runtime_error on a malformed or incompatible file
+  static stats_export read(std::istream& is) {
+    char m[sizeof(magic)];
+    is.read(m, sizeof(m));
+    if (!is || std::memcmp(m, magic, sizeof(magic)) != 0)
+      throw std::runtime_error("not a statistics file");
+    if (get<std::uint32_t>(is) != version)
+      throw std::runtime_error("unsupported statistics file version");
+    if (get<std::uint32_t>(is) != sub_bits || get<std::uint32_t>(is) != max_bits)
+      throw std::runtime_error("incompatible histogram layout");
+
+    stats_export e;
+    e.duration = get<std::uint64_t>(is);
+    std::uint64_t count = get<std::uint64_t>(is);
+    if (!is) throw std::runtime_error("truncated statistics file");
+    for (std::uint64_t n = 0; n < count; ++n) {
+      e.records.emplace_back();
+      target_record& r = e.records.back();
+      r.name.resize(get<std::uint16_t>(is));
+      is.read(&r.name[0], r.name.size());
+      stats_summary& s = r.stats;
+      s.targets = 1;
+      s.sent = get<std::uint64_t>(is);
+      s.received = get<std::uint64_t>(is);
+      s.lost = get<std::uint64_t>(is);
+      s.rtt_min = get<std::uint64_t>(is);
+      s.rtt_max = get<std::uint64_t>(is);
+      s.rtt_sum = get<std::uint64_t>(is);
+      s.rtt_mean = get_double(is);
+      s.rtt_m2 = get_double(is);
+      std::uint32_t used = get<std::uint32_t>(is);
+      for (std::uint32_t i = 0; i < used; ++i) {
+        std::uint16_t bucket = get<std::uint16_t>(is);
+        std::uint64_t n = get<std::uint64_t>(is);
+        if (bucket >= latency_histogram::bucket_count)
+          throw std::runtime_error("bucket out of range");
+        r.histogram.add_bucket(bucket, n);
+      }
+      if (s.received)
+        r.histogram.extend(s.rtt_min, s.rtt_max);
+      if (!is) throw std::runtime_error("truncated statistics file");
+    }
+    return e;
+  }
+
+  // Merge records of the same name, keeping the order of first appearance
+  static void merge(stats_export& e, const stats_export& from) {
+    e.duration = std::max(e.duration, from.duration);
+    std::vector<target_record>& into = e.records;
+    std::map<std::string, std::size_t> index;
+    for (std::size_t i = 0; i < into.size(); ++i)
+      index.emplace(into[i].name, i);
+    for (const auto& r : from.records) {
+      auto it = index.find(r.name);
+      if (it == index.end()) {
+        index.emplace(r.name, into.size());
+        into.push_back(r);
+      } else {
+        into[it->second].stats.merge(r.stats);
+        into[it->second].stats.targets = 1;
+        into[it->second].histogram.merge(r.histogram);
+      }
+    }
+  }
+
+private:
+  static constexpr int sub_bits = 6;
+  static constexpr int max_bits = 36;
+  static_assert(latency_histogram::bucket_count == (max_bits - sub_bits + 2) << (sub_bits - 1),
+      "histogram layout of the file format");
+
+  template<typename T>
+  static void put(std::ostream& os, std::uint64_t v) {
+    char b[sizeof(T)];
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+      b[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+    os.write(b, sizeof(T));
+  }
+
+  template<typename T>
+  static T get(std::istream& is) {
+    unsigned char b[sizeof(T)] = {};
+    is.read(reinterpret_cast<char*>(b), sizeof(T));
+    std::uint64_t v = 0;
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+      v |= std::uint64_t(b[i]) << (8 * i);
+    return static_cast<T>(v);
+  }
+
+  static void put_double(std::ostream& os, double d) {
+    std::uint64_t v;
+    std::memcpy(&v, &d, sizeof(v));
+    put<std::uint64_t>(os, v);
+  }
+
+  static double get_double(std::istream& is) {
+    std::uint64_t v = get<std::uint64_t>(is);
+    double d;
+    std::memcpy(&d, &v, sizeof(d));
+    return d;
+  }
+};
+
+}
+
+#endif
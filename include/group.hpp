@@ -0,0 +1,93 @@
+#ifndef GROUP_HPP
+#define GROUP_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nettool {
+
+// A host argument with its group labels, "host@label[,label...]". A label
+// is a path: "eu/fra/r3" puts the target in eu, eu/fra and eu/fra/r3.
+struct labeled_host {
+  std::string host;
+  std::vector<std::string> groups;
+
+  static labeled_host parse(const std::string& arg) {
+    labeled_host h;
+    std::size_t at = arg.find('@');
+    h.host = arg.substr(0, at);
+    if (at == std::string::npos) return h;
+    std::string labels = arg.substr(at + 1);
+    std::size_t begin = 0;
+    while (begin <= labels.size()) {
+      std::size_t end = labels.find(',', begin);
+      if (end == std::string::npos) end = labels.size();
+      std::string label = labels.substr(begin, end - begin);
+      for (std::size_t slash = 0; !label.empty(); ) {
+        slash = label.find('/', slash);
+        h.groups.push_back(label.substr(0, slash));
+        if (slash == std::string::npos) break;
+        ++slash;
+      }
+      begin = end + 1;
+    }
+    return h;
+  }
+};
+
+// Name of the subnet of an address in host order, "10.1.2.0/24"
+inline std::string subnet_name(std::uint32_t addr, int prefix) {
+  std::uint32_t net = prefix ? addr & ~((std::uint64_t(1) << (32 - prefix)) - 1) : 0;
+  return std::to_string(net >> 24) + "." + std::to_string((net >> 16) & 0xFF) + "."
+    + std::to_string((net >> 8) & 0xFF) + "." + std::to_string(net & 0xFF)
+    + "/" + std::to_string(prefix);
+}
+
+// Names of the groups, by id in order of first appearance, and the number
+// of targets in each
+class group_table {
+public:
+  // Id of a group, a new one without members if there is no such group
+  std::size_t add(const std::string& name) {
+    auto it = ids_.find(name);
+    if (it == ids_.end()) {
+      it = ids_.emplace(name, names_.size()).first;
+      names_.push_back(name);
+      members_.push_back(0);
+    }
+    return it->second;
+  }
+
+  std::size_t add_member(const std::string& name) {
+    std::size_t id = add(name);
+    ++members_[id];
+    return id;
+  }
+
+  // A group stays when its last member leaves, its statistics remain
+  void remove_member(std::size_t id) { --members_[id]; }
+
+  // Return false if there is no such group
+  bool find(const std::string& name, std::size_t& id) const {
+    auto it = ids_.find(name);
+    if (it == ids_.end()) return false;
+    id = it->second;
+    return true;
+  }
+
+  std::size_t size() const { return names_.size(); }
+  const std::string& name(std::size_t id) const { return names_[id]; }
+  const std::vector<std::string>& names() const { return names_; }
+  std::size_t members(std::size_t id) const { return members_[id]; }
+
+private:
+  std::unordered_map<std::string, std::size_t> ids_;
+  std::vector<std::string> names_;
+  std::vector<std::size_t> members_;
+};
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define HEADER_HPP
 
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <boost/asio/ip/address.hpp>
 
@@ -101,6 +102,74 @@ void compute_checksum(icmp_header& header, Iterator body_begin, Iterator body_en
 }
 
 
+// Body of the ICMP timestamp request and reply messages (RFC 792).
+//
+// The wire format following the ICMP header is:
+//
+// 0               8               16                             31
+// +---------------+---------------+------------------------------+      ---
+// |                                                              |       ^
+// |                     originate timestamp                      |       |
+// |                                                              |       |
+// +--------------------------------------------------------------+       |
+// |                                                              |       |
+// |                      receive timestamp                       |   12 bytes
+// |                                                              |       |
+// +--------------------------------------------------------------+       |
+// |                                                              |       |
+// |                      transmit timestamp                      |       |
+// |                                                              |       v
+// +--------------------------------------------------------------+      ---
+//
+// A timestamp is the number of milliseconds since midnight UT, a value with
+// the high order bit set is not in this standard unit.
+
+class icmp_timestamp {
+public:
+  enum { non_standard = 0x80000000u };
+
+  icmp_timestamp() { std::fill(rep_, rep_ + 12, 0); }
+
+  std::uint32_t originate() const { return decode(0); }
+  std::uint32_t receive() const { return decode(4); }
+  std::uint32_t transmit() const { return decode(8); }
+
+  void originate(std::uint32_t n) { encode(0, n); }
+  void receive(std::uint32_t n) { encode(4, n); }
+  void transmit(std::uint32_t n) { encode(8, n); }
+
+  bool standard() const {
+    return ((originate() | receive() | transmit()) & non_standard) == 0;
+  }
+
+  const byte_type* begin() const { return rep_; }
+  const byte_type* end() const { return rep_ + 12; }
+
+  friend std::istream& operator>>(std::istream& is, icmp_timestamp& body) {
+    return is.read(reinterpret_cast<char*>(body.rep_), 12);
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const icmp_timestamp& body) {
+    return os.write(reinterpret_cast<const char*>(body.rep_), 12);
+  }
+
+private:
+  std::uint32_t decode(int a) const {
+    return (std::uint32_t(rep_[a]) << 24) + (rep_[a + 1] << 16)
+      + (rep_[a + 2] << 8) + rep_[a + 3];
+  }
+
+  void encode(int a, std::uint32_t n) {
+    rep_[a] = static_cast<byte_type>(n >> 24);
+    rep_[a + 1] = static_cast<byte_type>((n >> 16) & 0xFF);
+    rep_[a + 2] = static_cast<byte_type>((n >> 8) & 0xFF);
+    rep_[a + 3] = static_cast<byte_type>(n & 0xFF);
+  }
+
+  byte_type rep_[12];
+};
+
+
 // Packet header for IPv4.
 //
 // The wire format of an IPv4 header is:
@@ -0,0 +1,141 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace nettool {
+
+// Log-linear histogram of integer values in the spirit of HdrHistogram.
+//
+// Values below 2^SubBits have a bucket each. Above, every power of two range
+// [2^k, 2^(k+1)) is split into 2^(SubBits-1) buckets of equal width, so a
+// bucket is never wider than 2^-(SubBits-1) of its values. Values from
+// 2^MaxBits on are counted in the last bucket, min and max stay exact.
+//
+// The bucket of v is shift * 2^(SubBits-1) + (v >> shift), with shift the
+// number of low bits dropped: 0 below 2^SubBits, msb(v) - SubBits + 1 above.
+// Counters saturate instead of wrapping around, when recording as when
+// merging; a value dropped by a full counter is left out of the total too,
+// which stays the sum of the buckets for percentile() and merge().
+template<int SubBits, int MaxBits, typename Count = std::uint32_t>
+class log_histogram {
+public:
+  static constexpr int half = 1 << (SubBits - 1);
+  static constexpr int bucket_count = (MaxBits - SubBits + 2) * half;
+  static constexpr std::uint64_t max_trackable = (std::uint64_t(1) << MaxBits) - 1;
+
+  log_histogram() { reset(); }
+
+  void reset() {
+    std::fill(counts_, counts_ + bucket_count, 0);
+    total_ = 0;
+    min_ = std::numeric_limits<std::uint64_t>::max();
+    max_ = 0;
+  }
+
+  void record(std::uint64_t v) {
+    min_ = std::min(min_, v);
+    max_ = std::max(max_, v);
+    total_ += add(counts_[index(v)], 1);
+  }
+
+  // Counts and extremes of another histogram of the same layout
+  template<typename C>
+  void merge(const log_histogram<SubBits, MaxBits, C>& other) {
+    if (other.count() == 0) return;
+    const C* counts = other.counts();
+    for (int i = 0; i < bucket_count; ++i)
+      total_ += add(counts_[i], counts[i]);
+    min_ = std::min(min_, other.min());
+    max_ = std::max(max_, other.max());
+  }
+
+  // Remove the counts of an older state of the same histogram, what was
+  // recorded since then remains. The extremes become those of the remaining
+  // buckets.
+  void subtract(const log_histogram& older) {
+    total_ = 0;
+    min_ = std::numeric_limits<std::uint64_t>::max();
+    max_ = 0;
+    for (int i = 0; i < bucket_count; ++i) {
+      counts_[i] -= older.counts_[i];
+      if (counts_[i] == 0) continue;
+      total_ += counts_[i];
+      min_ = std::min(min_, lower_bound(i));
+      max_ = lower_bound(i) + bucket_width(i) - 1;
+    }
+  }
+
+  // Rebuild a histogram from its buckets: add n values to bucket i, then
+  // set the exact extremes with extend()
+  void add_bucket(int i, std::uint64_t n) { total_ += add(counts_[i], n); }
+
+  void extend(std::uint64_t lo, std::uint64_t hi) {
+    min_ = std::min(min_, lo);
+    max_ = std::max(max_, hi);
+  }
+
+  std::uint64_t count() const { return total_; }
+  std::uint64_t min() const { return total_ ? min_ : 0; }
+  std::uint64_t max() const { return max_; }
+
+  // Smallest value v such that at least p percent of the values are <= v,
+  // reported as the middle of its bucket
+  std::uint64_t percentile(double p) const {
+    if (total_ == 0) return 0;
+    std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(p / 100.0 * total_));
+    rank = std::max<std::uint64_t>(rank, 1);
+    std::uint64_t seen = 0;
+    for (int i = 0; i < bucket_count; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        std::uint64_t mid = lower_bound(i) + (bucket_width(i) - 1) / 2;
+        return std::min(std::max(mid, min()), max_);
+      }
+    }
+    return max_;
+  }
+
+  static int index(std::uint64_t v) {
+    v = std::min(v, max_trackable);
+    int msb = 63 - __builtin_clzll(v | 1);
+    int shift = std::max(0, msb - SubBits + 1);
+    return shift * half + static_cast<int>(v >> shift);
+  }
+
+  static std::uint64_t lower_bound(int i) {
+    if (i < 2 * half) return i;
+    int shift = i / half - 1;
+    return static_cast<std::uint64_t>(i - shift * half) << shift;
+  }
+
+  static std::uint64_t bucket_width(int i) {
+    return i < 2 * half ? 1 : std::uint64_t(1) << (i / half - 1);
+  }
+
+  const Count* counts() const { return counts_; }
+
+private:
+  // Add up to n to a counter, return what fit
+  static std::uint64_t add(Count& c, std::uint64_t n) {
+    n = std::min<std::uint64_t>(n, std::numeric_limits<Count>::max() - c);
+    c += static_cast<Count>(n);
+    return n;
+  }
+
+  Count counts_[bucket_count];
+  std::uint64_t total_;
+  std::uint64_t min_;
+  std::uint64_t max_;
+};
+
+// Round trip times in nanoseconds: 1024 buckets of at most 3.2% relative
+// width up to 68.7 s, 4 KB per target
+using latency_histogram = log_histogram<6, 36>;
+
+}
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+
+#include "histogram.hpp"
+#include "stats.hpp"
+#include "window.hpp"
+
+namespace nettool {
+
+// Statistics in the OpenMetrics text format, served over HTTP on the
+// io_service of the pinger.
+//
+// A scrape reads the live stores directly, there is nothing to lock: it is
+// rendered in chunks of about chunk_bytes, and the next chunk is only
+// rendered once the previous one is written, so replies and timers run in
+// between and a slow scraper only holds its own connection. A family is
+// complete before the next one starts, as the format asks; a scrape of a
+// busy target may thus see a few more probes in a later family than in an
+// earlier one.
+//
+// Per target and per group (with "all" for every target):
+//   ping_sent_total, ping_received_total, ping_lost_total     counters
+//   ping_rtt_seconds                                           histogram
+// the group families are named ping_group_*. With sliding windows, per
+// target and window="1m", "5m" or "15m":
+//   ping_window_received, ping_window_lost                     gauges
+//   ping_window_rtt_seconds                                    gauge with
+//                                                              quantile="0.5", "0.99", "1"
+// the windows of a target are computed once per scrape. Targets and groups may be
+// added while the server runs, a target with empty labels has been removed
+// and is left out. Histogram buckets are read from the latency histogram,
+// whose buckets are at most 3.2% wide, so a bucket le="x" may count values
+// up to 3.2% above x.
+class metrics_server {
+public:
+  using tcp = boost::asio::ip::tcp;
+
+  enum { chunk_bytes = 64 * 1024 };
+
+  // Fills the sliding windows of a target, false if it keeps none
+  using window_source = std::function<bool(std::size_t id,
+      window_summary (&windows)[sliding_windows::window_count])>;
+
+  // The label sets of the targets, rendered by the owner, and the names of
+  // the groups are read at every scrape
+  metrics_server(boost::asio::io_service& io_service, const tcp::endpoint& endpoint,
+      const stats_store& targets, const std::vector<std::string>& target_labels,
+      const stats_store& groups, const std::vector<std::string>& group_names,
+      window_source windows = window_source())
+      : io_service_(io_service), acceptor_(io_service, endpoint), targets_(targets),
+      groups_(groups), target_labels_(target_labels), group_names_(group_names),
+      windows_(std::move(windows)) {
+    group_labels_.push_back("group=\"all\"");
+    for (std::size_t i = 0; i < bound_count; ++i)
+      cuts_[i] = latency_histogram::index(bounds[i]);
+    start_accept();
+  }
+
+  // Label value as quoted in the exposition format
+  static std::string label_value(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+      if (c == '\\' || c == '"') out += '\\';
+      if (c == '\n') {
+        out += "\\n";
+        continue;
+      }
+      out += c;
+    }
+    return out + "\"";
+  }
+
+private:
+  static constexpr std::size_t bound_count = 12;
+  // Bucket bounds in nanoseconds
+  static constexpr std::uint64_t bounds[bound_count] = {
+    500000, 1000000, 2500000, 5000000, 10000000, 25000000,
+    50000000, 100000000, 250000000, 500000000, 1000000000, 2500000000
+  };
+  static constexpr const char* bound_labels[bound_count] = {
+    "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025",
+    "0.05", "0.1", "0.25", "0.5", "1", "2.5"
+  };
+
+  // One scrape, rendered family by family and entry by entry
+  class session : public std::enable_shared_from_this<session> {
+  public:
+    session(boost::asio::io_service& io_service, const metrics_server& server)
+        : socket_(io_service), deadline_(io_service), request_(8192), server_(server),
+        family_(0), entry_(0) {}
+
+    tcp::socket& socket() { return socket_; }
+
+    void start() {
+      deadline_.expires_from_now(boost::posix_time::seconds(30));
+      deadline_.async_wait(boost::bind(&session::handle_deadline, shared_from_this(),
+            boost::asio::placeholders::error));
+      boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+          boost::bind(&session::handle_request, shared_from_this(),
+            boost::asio::placeholders::error));
+    }
+
+  private:
+    enum family_type {
+      sent, received, lost, rtt, group_sent, group_received, group_lost, group_rtt,
+      window_received, window_lost, window_rtt, done
+    };
+
+    void handle_deadline(const boost::system::error_code& ec) {
+      if (ec) return;
+      boost::system::error_code ignored;
+      socket_.close(ignored);
+    }
+
+    void handle_request(const boost::system::error_code& ec) {
+      if (ec) return finish();
+      std::istream is(&request_);
+      std::string method, path;
+      is >> method >> path;
+      auto out = std::back_inserter(buffer_);
+      if (method != "GET" || (path != "/metrics" && path != "/")) {
+        fmt::format_to(out, FMT_COMPILE("HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n"
+              "Connection: close\r\n\r\nnot found\n"));
+        family_ = done;
+      } else {
+        fmt::format_to(out, FMT_COMPILE("HTTP/1.1 200 OK\r\n"
+              "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+              "Connection: close\r\n\r\n"));
+        render();
+      }
+      write();
+    }
+
+    void write() {
+      boost::asio::async_write(socket_, boost::asio::buffer(buffer_.data(), buffer_.size()),
+          boost::bind(&session::handle_write, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handle_write(const boost::system::error_code& ec) {
+      buffer_.clear();
+      if (ec || family_ == done) return finish();
+      render();
+      write();
+    }
+
+    void finish() {
+      boost::system::error_code ignored;
+      socket_.shutdown(tcp::socket::shutdown_both, ignored);
+      socket_.close(ignored);
+      deadline_.cancel();
+    }
+
+    // Render from where the previous chunk stopped until the buffer holds
+    // a chunk or the scrape is complete
+    void render() {
+      auto out = std::back_inserter(buffer_);
+      while (family_ != done && buffer_.size() < chunk_bytes) {
+        if (family_ >= window_received) {
+          render_windows();
+          continue;
+        }
+        bool group = family_ >= group_sent;
+        const char* prefix = group ? "ping_group_" : "ping_";
+        std::size_t count = group ? server_.group_names_.size() + 1 : server_.target_labels_.size();
+        if (entry_ == 0) {
+          static const char* const names[] = {"sent", "received", "lost", "rtt_seconds"};
+          static const char* const help[] = {
+            "Probes sent", "Replies received", "Probes timed out", "Round trip time"
+          };
+          int kind = family_ % 4;
+          fmt::format_to(out, FMT_COMPILE("# TYPE {}{} {}\n# HELP {}{} {}.\n"),
+              prefix, names[kind], kind == 3 ? "histogram" : "counter",
+              prefix, names[kind], help[kind]);
+          if (family_ == group_sent)
+            all_ = server_.targets_.rollup(0, server_.targets_.size());
+        }
+        if (entry_ == count) {
+          next_family();
+          continue;
+        }
+        const std::string& labels = group ? server_.group_label(entry_) : server_.target_labels_[entry_];
+        if (labels.empty()) {
+          ++entry_;
+          continue;
+        }
+        // The "all" entry precedes the groups, group i + 1 is id i
+        bool all = group && entry_ == 0;
+        std::size_t id = group && !all ? entry_ - 1 : entry_;
+        const stats_store& store = group ? server_.groups_ : server_.targets_;
+        switch (family_) {
+          case sent: case group_sent:
+            fmt::format_to(out, FMT_COMPILE("{}sent_total{{{}}} {}\n"), prefix, labels,
+                all ? all_.sent : store.sent(id));
+            break;
+          case received: case group_received:
+            fmt::format_to(out, FMT_COMPILE("{}received_total{{{}}} {}\n"), prefix, labels,
+                all ? all_.received : store.received(id));
+            break;
+          case lost: case group_lost:
+            fmt::format_to(out, FMT_COMPILE("{}lost_total{{{}}} {}\n"), prefix, labels,
+                all ? all_.lost : store.lost(id));
+            break;
+          case rtt:
+            // The histogram of all targets is summed on the way
+            histogram(prefix, labels, store.histogram(id), store.at(id).rtt_sum);
+            all_histogram_.merge(store.histogram(id));
+            break;
+          case group_rtt:
+            if (all)
+              histogram(prefix, labels, all_histogram_, all_.rtt_sum);
+            else
+              histogram(prefix, labels, store.histogram(id), store.at(id).rtt_sum);
+            break;
+        }
+        ++entry_;
+      }
+    }
+
+    void next_family() {
+      ++family_;
+      entry_ = 0;
+      if (family_ == window_received && !server_.windows_) family_ = done;
+      if (family_ == done)
+        fmt::format_to(std::back_inserter(buffer_), FMT_COMPILE("# EOF\n"));
+    }
+
+    // One entry of a window family. The windows of a target are computed
+    // by the first family and kept for the other two.
+    void render_windows() {
+      auto out = std::back_inserter(buffer_);
+      std::size_t count = server_.target_labels_.size();
+      if (entry_ == 0) {
+        static const char* const names[] = {"received", "lost", "rtt_seconds"};
+        static const char* const help[] = {
+          "Replies received in the window", "Probes timed out in the window",
+          "Round trip time in the window"
+        };
+        int kind = family_ - window_received;
+        fmt::format_to(out, FMT_COMPILE("# TYPE ping_window_{} gauge\n# HELP ping_window_{} {}.\n"),
+            names[kind], names[kind], help[kind]);
+        if (family_ == window_received) windows_.assign(count, {});
+      }
+      if (entry_ == count) return next_family();
+      std::size_t id = entry_++;
+      const std::string& labels = server_.target_labels_[id];
+      if (labels.empty() || id >= windows_.size()) return;
+      kept_windows& k = windows_[id];
+      if (family_ == window_received) k.valid = server_.windows_(id, k.windows);
+      if (!k.valid) return;
+      for (int i = 0; i < sliding_windows::window_count; ++i) {
+        const window_summary& w = k.windows[i];
+        int minutes = sliding_windows::minutes[i];
+        switch (family_) {
+          case window_received:
+            fmt::format_to(out, FMT_COMPILE("ping_window_received{{{},window=\"{}m\"}} {}\n"),
+                labels, minutes, w.received);
+            break;
+          case window_lost:
+            fmt::format_to(out, FMT_COMPILE("ping_window_lost{{{},window=\"{}m\"}} {}\n"),
+                labels, minutes, w.lost);
+            break;
+          case window_rtt:
+            fmt::format_to(out, FMT_COMPILE("ping_window_rtt_seconds{{{},window=\"{}m\",quantile=\"0.5\"}} {:.9f}\n"
+                  "ping_window_rtt_seconds{{{},window=\"{}m\",quantile=\"0.99\"}} {:.9f}\n"
+                  "ping_window_rtt_seconds{{{},window=\"{}m\",quantile=\"1\"}} {:.9f}\n"),
+                labels, minutes, w.p50 / 1e9, labels, minutes, w.p99 / 1e9,
+                labels, minutes, w.max / 1e9);
+            break;
+        }
+      }
+    }
+
+    void histogram(const char* prefix, const std::string& labels,
+        const latency_histogram& h, std::uint64_t sum) {
+      auto out = std::back_inserter(buffer_);
+      const auto* counts = h.counts();
+      std::uint64_t below = 0;
+      int i = 0;
+      for (std::size_t b = 0; b < bound_count; ++b) {
+        // Every bucket up to the one holding the bound
+        for (; below < h.count() && i <= server_.cuts_[b]; ++i)
+          below += counts[i];
+        fmt::format_to(out, FMT_COMPILE("{}rtt_seconds_bucket{{{},le=\"{}\"}} {}\n"),
+            prefix, labels, bound_labels[b], below);
+      }
+      fmt::format_to(out, FMT_COMPILE("{}rtt_seconds_bucket{{{},le=\"+Inf\"}} {}\n"
+            "{}rtt_seconds_count{{{}}} {}\n{}rtt_seconds_sum{{{}}} {:.9f}\n"),
+          prefix, labels, h.count(), prefix, labels, h.count(), prefix, labels, sum / 1e9);
+    }
+
+    tcp::socket socket_;
+    boost::asio::deadline_timer deadline_;
+    boost::asio::streambuf request_;
+    const metrics_server& server_;
+    fmt::memory_buffer buffer_;
+    int family_;
+    std::size_t entry_;
+    stats_summary all_;
+    latency_histogram all_histogram_;
+    struct kept_windows {
+      bool valid = false;
+      window_summary windows[sliding_windows::window_count];
+    };
+    // Targets added during the scrape are left out of the window families
+    std::vector<kept_windows> windows_;
+  };
+
+  // Labels of group i - 1, or of all targets for 0, rendered once
+  const std::string& group_label(std::size_t i) const {
+    while (group_labels_.size() <= i)
+      group_labels_.push_back("group=" + label_value(group_names_[group_labels_.size() - 1]));
+    return group_labels_[i];
+  }
+
+  void start_accept() {
+    std::shared_ptr<session> s(new session(io_service_, *this));
+    acceptor_.async_accept(s->socket(), boost::bind(&metrics_server::handle_accept,
+          this, s, boost::asio::placeholders::error));
+  }
+
+  void handle_accept(std::shared_ptr<session> s, const boost::system::error_code& ec) {
+    if (!ec) s->start();
+    start_accept();
+  }
+
+  boost::asio::io_service& io_service_;
+  tcp::acceptor acceptor_;
+  const stats_store& targets_;
+  const stats_store& groups_;
+  const std::vector<std::string>& target_labels_;
+  const std::vector<std::string>& group_names_;
+  window_source windows_;
+  mutable std::vector<std::string> group_labels_;
+  int cuts_[bound_count];
+};
+
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <cerrno>
+#include <iterator>
+#include <utility>
+#include <unistd.h>
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+
+namespace nettool {
+
+// Standard output formatted with fmt into one large buffer.
+//
+// Nothing is written per line: the buffer goes out in a single write(2)
+// once it holds flush_bytes, when flush() is called (the pinger does so on
+// a timer and before exiting), or after each line on a terminal, where a
+// reply should show up as it arrives.
+class output {
+public:
+  enum { flush_bytes = 64 * 1024 };
+
+  explicit output(int fd = STDOUT_FILENO) : fd_(fd), tty_(::isatty(fd)) {}
+  ~output() { flush(); }
+
+  output(const output&) = delete;
+  output& operator=(const output&) = delete;
+
+  template<typename S, typename... Args>
+  void print(const S& format, Args&&... args) {
+    fmt::format_to(std::back_inserter(buffer_), format, std::forward<Args>(args)...);
+  }
+
+  // A line is complete, write it out if it is due
+  void end_line() {
+    if (tty_ || buffer_.size() >= flush_bytes) flush();
+  }
+
+  void flush() {
+    const char* p = buffer_.data();
+    std::size_t left = buffer_.size();
+    while (left) {
+      ssize_t n = ::write(fd_, p, left);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      p += n;
+      left -= n;
+    }
+    buffer_.clear();
+  }
+
+  bool empty() const { return buffer_.size() == 0; }
+
+private:
+  int fd_;
+  bool tty_;
+  fmt::memory_buffer buffer_;
+};
+
+}
+
+#endif
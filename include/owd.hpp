@@ -0,0 +1,114 @@
+#ifndef OWD_HPP
+#define OWD_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace nettool {
+
+// Difference a - b of two times of day in microseconds, across midnight
+inline std::int64_t time_of_day_diff(std::int64_t a, std::int64_t b) {
+  const std::int64_t day = 86400000000LL;
+  std::int64_t d = (a - b) % day;
+  if (d > day / 2) d -= day;
+  if (d <= -day / 2) d += day;
+  return d;
+}
+
+// Running min/avg/max of a delay in microseconds
+struct delay_stats {
+  void record(std::int64_t v) {
+    ++count;
+    sum += v;
+    min = std::min(min, v);
+    max = std::max(max, v);
+  }
+
+  double avg() const { return count ? sum / static_cast<double>(count) : 0; }
+
+  std::uint64_t count = 0;
+  std::int64_t sum = 0;
+  std::int64_t min = std::numeric_limits<std::int64_t>::max();
+  std::int64_t max = std::numeric_limits<std::int64_t>::min();
+};
+
+// One-way delay and clock offset estimates from ICMP timestamp replies.
+//
+// With T1 and T4 our send and receive times, T2 and T3 the receive and
+// transmit timestamps of the target, all as times of day in microseconds:
+//
+//   forward = T2 - T1
+//   reverse = T4 - T3
+//   offset  = ((T2 - T1) + (T3 - T4)) / 2, the clock of the target minus ours
+//
+// forward and reverse are only meaningful when both clocks are synchronized,
+// otherwise the offset hides in them and only their sum is exact. As in the
+// NTP clock filter, the offset of the sample with the smallest delay among the
+// recent ones is the best estimate, queuing inflates the others. Its change
+// since the first estimate gives the drift of the target clock.
+class owd_tracker {
+public:
+  enum { filter_size = 8 };
+
+  // local_rx and local_tx are the local times of day of the reply and request
+  void update(std::int64_t local_tx, std::int64_t remote_rx,
+      std::int64_t remote_tx, std::int64_t local_rx) {
+    std::int64_t fwd = time_of_day_diff(remote_rx, local_tx);
+    std::int64_t rev = time_of_day_diff(local_rx, remote_tx);
+    forward_.record(fwd);
+    reverse_.record(rev);
+    last_forward_ = fwd;
+    last_reverse_ = rev;
+    last_offset_ = (fwd - rev) / 2;
+
+    filter_[filter_pos_] = sample{fwd + rev, last_offset_, local_rx};
+    filter_pos_ = (filter_pos_ + 1) % filter_size;
+    filter_len_ = std::min(filter_len_ + 1, static_cast<int>(filter_size));
+    const sample* best = &filter_[0];
+    for (int i = 1; i < filter_len_; ++i)
+      if (filter_[i].delay < best->delay) best = &filter_[i];
+    offset_ = best->offset;
+    if (!has_first_) {
+      has_first_ = true;
+      first_ = *best;
+    }
+    elapsed_ = time_of_day_diff(best->time, first_.time);
+  }
+
+  const delay_stats& forward() const { return forward_; }
+  const delay_stats& reverse() const { return reverse_; }
+  std::int64_t last_forward() const { return last_forward_; }
+  std::int64_t last_reverse() const { return last_reverse_; }
+  std::int64_t last_offset() const { return last_offset_; }
+  // Offset of the minimum delay sample among the last filter_size
+  std::int64_t offset() const { return offset_; }
+  // Drift of the filtered offset in parts per million
+  double drift_ppm() const {
+    return elapsed_ > 0 ? (offset_ - first_.offset) * 1e6 / elapsed_ : 0;
+  }
+
+private:
+  struct sample {
+    std::int64_t delay;
+    std::int64_t offset;
+    std::int64_t time;
+  };
+
+  delay_stats forward_;
+  delay_stats reverse_;
+  std::int64_t last_forward_ = 0;
+  std::int64_t last_reverse_ = 0;
+  std::int64_t last_offset_ = 0;
+  std::int64_t offset_ = 0;
+  sample filter_[filter_size] = {};
+  int filter_pos_ = 0;
+  int filter_len_ = 0;
+  bool has_first_ = false;
+  sample first_ = {};
+  std::int64_t elapsed_ = 0;
+};
+
+}
+
+#endif
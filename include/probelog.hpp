@@ -0,0 +1,234 @@
+#ifndef PROBELOG_HPP
+#define PROBELOG_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nettool {
+
+// One probe result as logged, 24 bytes
+struct probe_entry {
+  enum outcome_type : std::uint8_t { reply, timeout, error };
+
+  // Send and receive times in ns since the epoch, no receive time unless
+  // the outcome is a reply
+  std::uint64_t tx;
+  std::uint64_t rx;
+  std::uint32_t target;
+  std::uint16_t seq;
+  std::uint8_t outcome;
+  std::uint8_t ttl;
+};
+static_assert(sizeof(probe_entry) == 24, "probe_entry is stored as is");
+
+// Fixed size records of every probe in a ring file mapped into memory.
+//
+// The file is a header page, the names of the targets and the ring, all in
+// the byte order of the host:
+//
+//   char[8]   magic "NTPRBLOG"
+//   u32, u32  version and record size
+//   u64       capacity in records, a power of two
+//   u64       offset of the ring, a multiple of the page size
+//   u64       number of target slots
+//   u64       creation time (ns since the epoch)
+//   u64       write cursor, on a cache line of its own
+//   per target slot, after the header:
+//     char[64], char[16]   host and address, NUL padded, empty if unused
+//
+// A target added while the log is written gets its name in its slot, a
+// reader opened later sees it.
+//
+// The cursor counts the records ever written, record n lives in slot
+// n % capacity. Appending is a release fence, the stores of the record and a
+// release store of the cursor: no system call, the kernel writes the dirty
+// pages back on its own. A crash of the process loses nothing that was appended, and a
+// crash while a record is written leaves the cursor before it, so the
+// record in the slot being overwritten, the oldest one, is the only one a
+// reader cannot trust and is skipped.
+class probe_log {
+public:
+  static constexpr char magic[8] = {'N', 'T', 'P', 'R', 'B', 'L', 'O', 'G'};
+  enum { version = 2, page = 4096 };
+  enum { host_bytes = 64, address_bytes = 16, name_bytes = host_bytes + address_bytes };
+
+  struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t record_size;
+    std::uint64_t capacity;
+    std::uint64_t records_offset;
+    std::uint64_t targets;
+    std::uint64_t created;
+    alignas(64) std::atomic<std::uint64_t> cursor;
+  };
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+      "the cursor is shared through the file");
+
+  struct target_name {
+    std::string host;
+    std::string address;
+  };
+
+  // Create or replace the file with a ring of at most bytes and room for
+  // the names of targets, throw std::runtime_error if it cannot be mapped
+  probe_log(const std::string& path, std::size_t bytes, std::size_t targets, std::uint64_t created) {
+    std::uint64_t capacity = 1;
+    while (capacity * 2 * sizeof(probe_entry) <= bytes) capacity <<= 1;
+    std::uint64_t offset = (sizeof(header) + targets * name_bytes + page - 1) / page * page;
+    size_ = offset + capacity * sizeof(probe_entry);
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) fail("cannot open " + path);
+    if (::ftruncate(fd, size_) < 0) {
+      ::close(fd);
+      fail("cannot size " + path);
+    }
+    void* p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) fail("cannot map " + path);
+    base_ = static_cast<char*>(p);
+
+    header* h = new (base_) header;
+    std::memcpy(h->magic, magic, sizeof(magic));
+    h->version = version;
+    h->record_size = sizeof(probe_entry);
+    h->capacity = capacity;
+    h->records_offset = offset;
+    h->targets = targets;
+    h->created = created;
+    h->cursor.store(0, std::memory_order_relaxed);
+    header_ = h;
+    records_ = reinterpret_cast<probe_entry*>(base_ + offset);
+    mask_ = capacity - 1;
+    cursor_ = 0;
+  }
+
+  ~probe_log() {
+    ::msync(base_, size_, MS_ASYNC);
+    ::munmap(base_, size_);
+  }
+
+  probe_log(const probe_log&) = delete;
+  probe_log& operator=(const probe_log&) = delete;
+
+  void append(const probe_entry& e) {
+    // The cursor of the previous record, which tells a reader this slot is
+    // taken, is visible before any byte of the overwrite
+    std::atomic_thread_fence(std::memory_order_release);
+    records_[cursor_ & mask_] = e;
+    header_->cursor.store(++cursor_, std::memory_order_release);
+  }
+
+  void set_name(std::size_t id, const std::string& host, const std::string& address) {
+    char* p = base_ + sizeof(header) + id * name_bytes;
+    std::memset(p, 0, name_bytes);
+    std::memcpy(p, host.data(), std::min<std::size_t>(host.size(), host_bytes - 1));
+    std::memcpy(p + host_bytes, address.data(), std::min<std::size_t>(address.size(), address_bytes - 1));
+  }
+
+  std::uint64_t capacity() const { return mask_ + 1; }
+  std::uint64_t written() const { return cursor_; }
+
+  static void fail(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+
+private:
+  char* base_;
+  std::size_t size_;
+  header* header_;
+  probe_entry* records_;
+  std::uint64_t mask_;
+  std::uint64_t cursor_;
+};
+
+// A probe log opened read only, possibly while it is being written
+class probe_log_reader {
+public:
+  // Throw std::runtime_error if the file is not a probe log
+  explicit probe_log_reader(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) probe_log::fail("cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || static_cast<std::size_t>(st.st_size) < sizeof(probe_log::header)) {
+      ::close(fd);
+      throw std::runtime_error(path + " is not a probe log");
+    }
+    size_ = st.st_size;
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) probe_log::fail("cannot map " + path);
+    base_ = static_cast<const char*>(p);
+    header_ = reinterpret_cast<const probe_log::header*>(base_);
+
+    const probe_log::header& h = *header_;
+    if (std::memcmp(h.magic, probe_log::magic, sizeof(probe_log::magic)) != 0
+        || h.version != probe_log::version || h.record_size != sizeof(probe_entry)
+        || h.capacity == 0 || (h.capacity & (h.capacity - 1)) != 0
+        || sizeof(probe_log::header) + h.targets * probe_log::name_bytes > h.records_offset
+        || h.records_offset + h.capacity * sizeof(probe_entry) > size_) {
+      ::munmap(const_cast<char*>(base_), size_);
+      throw std::runtime_error(path + " is not a probe log");
+    }
+    for (std::uint64_t i = 0; i < h.targets; ++i) {
+      const char* p = base_ + sizeof(probe_log::header) + i * probe_log::name_bytes;
+      const char* a = p + probe_log::host_bytes;
+      names_.push_back({std::string(p, strnlen(p, probe_log::host_bytes)),
+          std::string(a, strnlen(a, probe_log::address_bytes))});
+    }
+    records_ = reinterpret_cast<const probe_entry*>(base_ + h.records_offset);
+  }
+
+  ~probe_log_reader() { ::munmap(const_cast<char*>(base_), size_); }
+
+  probe_log_reader(const probe_log_reader&) = delete;
+  probe_log_reader& operator=(const probe_log_reader&) = delete;
+
+  const std::vector<probe_log::target_name>& targets() const { return names_; }
+  std::uint64_t capacity() const { return header_->capacity; }
+  std::uint64_t created() const { return header_->created; }
+  std::uint64_t written() const { return header_->cursor.load(std::memory_order_acquire); }
+
+  // Call f(entry) for every trustworthy record, oldest first. A record the
+  // writer overwrote while it was copied is left out.
+  template<typename F>
+  std::uint64_t for_each(F f) const {
+    std::uint64_t mask = header_->capacity - 1;
+    std::uint64_t end = written();
+    std::uint64_t first = end > mask ? end - mask : 0;
+    std::uint64_t skipped = 0;
+    for (std::uint64_t n = first; n < end; ++n) {
+      probe_entry e = records_[n & mask];
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // The writer may have reached the slot in the meantime
+      if (written() - n > mask) {
+        ++skipped;
+        continue;
+      }
+      if (e.target < names_.size()) f(e);
+    }
+    return skipped;
+  }
+
+private:
+  const char* base_;
+  std::size_t size_;
+  const probe_log::header* header_;
+  const probe_entry* records_;
+  std::vector<probe_log::target_name> names_;
+};
+
+}
+
+#endif
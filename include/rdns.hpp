@@ -0,0 +1,157 @@
+#ifndef RDNS_HPP
+#define RDNS_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+namespace nettool {
+
+// Names of IPv4 addresses by reverse (PTR) lookup, for output only.
+//
+// find() runs on the I/O thread and never waits: it returns the cached
+// name, or nullptr and queues a lookup. Lookups are blocking getnameinfo()
+// calls on a few threads of the cache; their results are posted back to the
+// io_service, so the cache itself is only touched by the I/O thread and
+// needs no lock. The threads share a bounded queue with it, a lookup which
+// does not fit is asked for again by the next find().
+//
+// The cache holds up to capacity addresses and drops the least recently
+// used. An entry is kept ttl seconds, an address without a name as well; an
+// expired name is still returned while it is looked up again.
+class name_cache {
+public:
+  enum { threads = 4, queue_size = 1024 };
+
+  name_cache(boost::asio::io_service& io_service, std::size_t capacity, std::int64_t ttl)
+      : io_service_(io_service), capacity_(capacity), ttl_(ttl), stop_(false) {
+    for (std::size_t i = 0; i < threads; ++i)
+      threads_.emplace_back([this] { run(); });
+  }
+
+  // Waits for the lookups under way, not for the queued ones
+  ~name_cache() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      queue_.clear();
+    }
+    wake_.notify_all();
+    for (std::thread& t : threads_)
+      t.join();
+  }
+
+  name_cache(const name_cache&) = delete;
+  name_cache& operator=(const name_cache&) = delete;
+
+  // Name of an address in host byte order, nullptr if not known (yet)
+  const std::string* find(std::uint32_t address) {
+    auto it = entries_.find(address);
+    if (it == entries_.end()) {
+      if (entries_.size() >= capacity_) evict();
+      it = entries_.emplace(address, entry()).first;
+      lru_.push_front(address);
+      it->second.use = lru_.begin();
+    } else {
+      lru_.splice(lru_.begin(), lru_, it->second.use);
+    }
+    entry& e = it->second;
+    if (!e.pending && now() >= e.expires)
+      e.pending = request(address);
+    return e.name.empty() ? nullptr : &e.name;
+  }
+
+  std::size_t size() const { return entries_.size(); }
+
+private:
+  struct entry {
+    std::string name;
+    // Expired from the start, so the first find() asks
+    std::int64_t expires = 0;
+    bool pending = false;
+    std::list<std::uint32_t>::iterator use;
+  };
+
+  static std::int64_t now() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void evict() {
+    entries_.erase(lru_.back());
+    lru_.pop_back();
+  }
+
+  bool request(std::uint32_t address) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (queue_.size() >= queue_size) return false;
+      queue_.push_back(address);
+    }
+    wake_.notify_one();
+    return true;
+  }
+
+  // On the I/O thread; the entry may have been evicted meanwhile
+  void resolved(std::uint32_t address, const std::string& name, std::int64_t at) {
+    auto it = entries_.find(address);
+    if (it == entries_.end()) return;
+    entry& e = it->second;
+    e.pending = false;
+    e.expires = at + ttl_;
+    // A failed lookup keeps a name found before
+    if (!name.empty()) e.name = name;
+  }
+
+  void run() {
+    for (;;) {
+      std::uint32_t address;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (stop_) return;
+        address = queue_.front();
+        queue_.pop_front();
+      }
+      sockaddr_in sa = {};
+      sa.sin_family = AF_INET;
+      sa.sin_addr.s_addr = htonl(address);
+      char host[NI_MAXHOST];
+      std::string name;
+      if (::getnameinfo(reinterpret_cast<sockaddr*>(&sa), sizeof(sa), host, sizeof(host),
+            nullptr, 0, NI_NAMEREQD) == 0)
+        name = host;
+      io_service_.post(boost::bind(&name_cache::resolved, this, address, name, now()));
+    }
+  }
+
+  boost::asio::io_service& io_service_;
+  std::size_t capacity_;
+  std::int64_t ttl_;
+  std::unordered_map<std::uint32_t, entry> entries_;
+  // Most recently used first
+  std::list<std::uint32_t> lru_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::uint32_t> queue_;
+  bool stop_;
+  std::vector<std::thread> threads_;
+};
+
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef RECORD_HPP
+#define RECORD_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+
+#include "histogram.hpp"
+#include "ring.hpp"
+#include "stats.hpp"
+
+namespace nettool {
+
+// Writes what a producer thread puts in a ring to a file descriptor, on a
+// thread of its own. The producer never blocks: a record which does not fit
+// is dropped and counted. The writer sleeps on a condition variable when
+// the ring is empty, and the producer only takes the mutex to wake it.
+class async_writer {
+public:
+  async_writer(int fd, std::size_t capacity)
+      : fd_(fd), ring_(capacity), dropped_(0), stop_(false), waiting_(false),
+      thread_([this] { run(); }) {}
+
+  ~async_writer() { stop(); }
+
+  async_writer(const async_writer&) = delete;
+  async_writer& operator=(const async_writer&) = delete;
+
+  // Return false if the record was dropped
+  bool write(const char* p, std::size_t n) {
+    if (!ring_.push(p, n)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (waiting_.load(std::memory_order_seq_cst)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_.notify_one();
+    }
+    return true;
+  }
+
+  // Write what is left and end the thread
+  void stop() {
+    if (!thread_.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  void run() {
+    for (;;) {
+      const char* p;
+      std::size_t n = ring_.peek(p);
+      if (n) {
+        ssize_t written = ::write(fd_, p, n);
+        if (written < 0 && errno == EINTR) continue;
+        // Nothing to do about a failed write but to go on
+        ring_.pop(written < 0 ? n : written);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (stop_ && ring_.empty()) return;
+      // Announce the wait before checking the ring once more, the producer
+      // publishes before it checks waiting_, so one of both sees the other
+      waiting_.store(true, std::memory_order_seq_cst);
+      wake_.wait(lock, [this] { return stop_ || !ring_.empty(); });
+      waiting_.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  int fd_;
+  spsc_ring ring_;
+  std::atomic<std::uint64_t> dropped_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_;
+  std::atomic<bool> waiting_;
+  std::thread thread_;
+};
+
+enum class record_format { text, json, csv };
+
+// One record per probe outcome and per summary, as JSON Lines or CSV.
+//
+// Records are formatted on the calling thread into a small buffer and
+// handed to an async_writer, so a slow consumer delays nothing but itself.
+// Times are seconds since the epoch, round trip times milliseconds. CSV has
+// one header and the same columns for every record, unused ones empty.
+class record_writer {
+public:
+  record_writer(record_format format, int fd, std::size_t capacity)
+      : format_(format), writer_(fd, capacity) {
+    if (format_ == record_format::csv) {
+      static const char header[] = "type,time,host,address,seq,ttl,bytes,rtt_ms,error,"
+        "scope,sent,received,lost,loss_pct,rtt_min_ms,rtt_avg_ms,rtt_max_ms,rtt_mdev_ms,"
+        "p50_ms,p90_ms,p99_ms,p999_ms,duration_s\n";
+      writer_.write(header, sizeof(header) - 1);
+    }
+  }
+
+  void reply(double time, const std::string& host, const std::string& address,
+      unsigned seq, unsigned ttl, std::size_t bytes, double rtt) {
+    fmt::memory_buffer b;
+    auto out = std::back_inserter(b);
+    if (format_ == record_format::json) {
+      fmt::format_to(out, FMT_COMPILE("{{\"type\":\"reply\",\"time\":{:.6f},\"host\":"), time);
+      json_string(b, host);
+      fmt::format_to(out, FMT_COMPILE(",\"address\":\"{}\",\"seq\":{},\"ttl\":{},\"bytes\":{},\"rtt_ms\":{:.3f}}}\n"),
+          address, seq, ttl, bytes, rtt);
+    } else {
+      fmt::format_to(out, FMT_COMPILE("reply,{:.6f},"), time);
+      csv_field(b, host);
+      fmt::format_to(out, FMT_COMPILE(",{},{},{},{},{:.3f},,,,,,,,,,,,,,,\n"), address, seq, ttl, bytes, rtt);
+    }
+    writer_.write(b.data(), b.size());
+  }
+
+  void timeout(double time, const std::string& host, const std::string& address, unsigned seq) {
+    fmt::memory_buffer b;
+    auto out = std::back_inserter(b);
+    if (format_ == record_format::json) {
+      fmt::format_to(out, FMT_COMPILE("{{\"type\":\"timeout\",\"time\":{:.6f},\"host\":"), time);
+      json_string(b, host);
+      fmt::format_to(out, FMT_COMPILE(",\"address\":\"{}\",\"seq\":{}}}\n"), address, seq);
+    } else {
+      fmt::format_to(out, FMT_COMPILE("timeout,{:.6f},"), time);
+      csv_field(b, host);
+      fmt::format_to(out, FMT_COMPILE(",{},{},,,,,,,,,,,,,,,,,,\n"), address, seq);
+    }
+    writer_.write(b.data(), b.size());
+  }
+
+  void error(double time, const std::string& host, const std::string& address,
+      unsigned seq, const std::string& message) {
+    fmt::memory_buffer b;
+    auto out = std::back_inserter(b);
+    if (format_ == record_format::json) {
+      fmt::format_to(out, FMT_COMPILE("{{\"type\":\"error\",\"time\":{:.6f},\"host\":"), time);
+      json_string(b, host);
+      fmt::format_to(out, FMT_COMPILE(",\"address\":\"{}\",\"seq\":{},\"error\":"), address, seq);
+      json_string(b, message);
+      fmt::format_to(out, FMT_COMPILE("}}\n"));
+    } else {
+      fmt::format_to(out, FMT_COMPILE("error,{:.6f},"), time);
+      csv_field(b, host);
+      fmt::format_to(out, FMT_COMPILE(",{},{},,,,"), address, seq);
+      csv_field(b, message);
+      fmt::format_to(out, FMT_COMPILE(",,,,,,,,,,,,,,\n"));
+    }
+    writer_.write(b.data(), b.size());
+  }
+
+  // scope is target, group or all
+  void summary(double time, const char* scope, const std::string& name,
+      const stats_summary& s, const latency_histogram& h, double duration) {
+    fmt::memory_buffer b;
+    auto out = std::back_inserter(b);
+    double loss = s.sent ? 100.0 * (s.sent - std::min(s.sent, s.received)) / s.sent : 0.0;
+    double lo = s.received ? s.rtt_min / 1e6 : 0, hi = s.rtt_max / 1e6;
+    if (format_ == record_format::json) {
+      fmt::format_to(out, FMT_COMPILE("{{\"type\":\"summary\",\"time\":{:.6f},\"scope\":\"{}\",\"name\":"),
+          time, scope);
+      json_string(b, name);
+      fmt::format_to(out, FMT_COMPILE(",\"sent\":{},\"received\":{},\"lost\":{},\"loss_pct\":{:.2f},"
+            "\"rtt_min_ms\":{:.3f},\"rtt_avg_ms\":{:.3f},\"rtt_max_ms\":{:.3f},\"rtt_mdev_ms\":{:.3f},"
+            "\"p50_ms\":{:.3f},\"p90_ms\":{:.3f},\"p99_ms\":{:.3f},\"p999_ms\":{:.3f},\"duration_s\":{:.3f}}}\n"),
+          s.sent, s.received, s.lost, loss, lo, s.rtt_mean / 1e6, hi, s.rtt_mdev() / 1e6,
+          h.percentile(50) / 1e6, h.percentile(90) / 1e6, h.percentile(99) / 1e6,
+          h.percentile(99.9) / 1e6, duration);
+    } else {
+      fmt::format_to(out, FMT_COMPILE("summary,{:.6f},"), time);
+      csv_field(b, name);
+      fmt::format_to(out, FMT_COMPILE(",,,,,,,{},{},{},{},{:.2f},{:.3f},{:.3f},{:.3f},{:.3f},"
+            "{:.3f},{:.3f},{:.3f},{:.3f},{:.3f}\n"),
+          scope, s.sent, s.received, s.lost, loss, lo, s.rtt_mean / 1e6, hi, s.rtt_mdev() / 1e6,
+          h.percentile(50) / 1e6, h.percentile(90) / 1e6, h.percentile(99) / 1e6,
+          h.percentile(99.9) / 1e6, duration);
+    }
+    writer_.write(b.data(), b.size());
+  }
+
+  void stop() { writer_.stop(); }
+  std::uint64_t dropped() const { return writer_.dropped(); }
+
+private:
+  static void json_string(fmt::memory_buffer& b, const std::string& s) {
+    b.push_back('"');
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        b.push_back('\\');
+        b.push_back(c);
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        fmt::format_to(std::back_inserter(b), FMT_COMPILE("\\u{:04x}"), static_cast<unsigned>(c));
+      } else {
+        b.push_back(c);
+      }
+    }
+    b.push_back('"');
+  }
+
+  // Quoted only if it has to
+  static void csv_field(fmt::memory_buffer& b, const std::string& s) {
+    if (s.find_first_of(",\"\n") == std::string::npos) {
+      b.append(s.data(), s.data() + s.size());
+      return;
+    }
+    b.push_back('"');
+    for (char c : s) {
+      if (c == '"') b.push_back('"');
+      b.push_back(c);
+    }
+    b.push_back('"');
+  }
+
+  record_format format_;
+  async_writer writer_;
+};
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef RING_HPP
+#define RING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+namespace nettool {
+
+// Lock-free ring of bytes between one producer and one consumer thread.
+//
+// The capacity is a power of two and the positions grow without bound, the
+// offset in the buffer is the position masked. The producer owns tail_, the
+// consumer head_, each on a cache line of its own, and each publishes with a
+// release store what the other reads with an acquire load.
+class spsc_ring {
+public:
+  explicit spsc_ring(std::size_t capacity) : mask_(round_up(capacity) - 1),
+      data_(new char[mask_ + 1]), head_(0), tail_(0) {}
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  // Producer: append all n bytes, or nothing and return false if they do
+  // not fit
+  bool push(const char* p, std::size_t n) {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    std::size_t head = head_.load(std::memory_order_acquire);
+    if (capacity() - (tail - head) < n) return false;
+    std::size_t offset = tail & mask_;
+    std::size_t first = std::min(n, capacity() - offset);
+    std::memcpy(data_.get() + offset, p, first);
+    std::memcpy(data_.get(), p + first, n - first);
+    tail_.store(tail + n, std::memory_order_seq_cst);
+    return true;
+  }
+
+  // Consumer: the readable bytes up to the end of the buffer, release them
+  // with pop() once used
+  std::size_t peek(const char*& p) const {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    std::size_t tail = tail_.load(std::memory_order_seq_cst);
+    std::size_t offset = head & mask_;
+    p = data_.get() + offset;
+    return std::min(tail - head, capacity() - offset);
+  }
+
+  void pop(std::size_t n) {
+    head_.store(head_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_seq_cst);
+  }
+
+private:
+  static std::size_t round_up(std::size_t n) {
+    std::size_t c = 1;
+    while (c < n) c <<= 1;
+    return c;
+  }
+
+  const std::size_t mask_;
+  std::unique_ptr<char[]> data_;
+  alignas(64) std::atomic<std::size_t> head_;
+  alignas(64) std::atomic<std::size_t> tail_;
+};
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef RTO_HPP
+#define RTO_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+namespace nettool {
+
+// Retransmission timeout estimator of RFC 6298, kept per target.
+//
+// All values are in microseconds. Before the first sample the timeout is the
+// upper bound, so an unknown path is treated as conservatively as before.
+//
+//   first sample R:  SRTT = R, RTTVAR = R / 2
+//   next sample R:   RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+//                    SRTT   = 7/8 SRTT   + 1/8 R
+//   RTO = SRTT + max(G, 4 * RTTVAR), clamped to [min, max]
+class rto_estimator {
+public:
+  // Clock granularity G of RFC 6298, the resolution of our timestamps
+  static constexpr std::int64_t granularity = 1;
+
+  rto_estimator(std::int64_t min_us, std::int64_t max_us)
+      : min_(min_us), max_(std::max(min_us, max_us)),
+      srtt_(0), rttvar_(0), rto_(max_) {}
+
+  std::int64_t rto() const { return rto_; }
+  std::int64_t srtt() const { return srtt_; }
+  std::int64_t rttvar() const { return rttvar_; }
+  bool has_sample() const { return srtt_ != 0; }
+
+  void update(std::int64_t rtt) {
+    rtt = std::max<std::int64_t>(rtt, 1);
+    if (!has_sample()) {
+      srtt_ = rtt;
+      rttvar_ = rtt / 2;
+    } else {
+      // rttvar must use the old srtt
+      rttvar_ += (std::llabs(srtt_ - rtt) - rttvar_) / 4;
+      srtt_ += (rtt - srtt_) / 8;
+    }
+    rto_ = clamp(srtt_ + std::max(granularity, 4 * rttvar_));
+  }
+
+  // Resume from the values of an earlier estimator
+  void restore(std::int64_t srtt, std::int64_t rttvar, std::int64_t rto) {
+    srtt_ = std::max<std::int64_t>(srtt, 0);
+    rttvar_ = std::max<std::int64_t>(rttvar, 0);
+    rto_ = has_sample() ? clamp(rto) : max_;
+  }
+
+  // Exponential back off on a loss (RFC 6298 5.5), undone by the next sample
+  void backoff() { rto_ = clamp(rto_ * 2); }
+
+private:
+  std::int64_t clamp(std::int64_t v) const {
+    return std::min(max_, std::max(min_, v));
+  }
+
+  std::int64_t min_;
+  std::int64_t max_;
+  std::int64_t srtt_;
+  std::int64_t rttvar_;
+  std::int64_t rto_;
+};
+
+}
+
+#endif
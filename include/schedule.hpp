@@ -0,0 +1,105 @@
+#ifndef SCHEDULE_HPP
+#define SCHEDULE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+
+namespace nettool {
+
+// Inter-probe gap generator.
+//
+// A probe sent a fixed time after the previous one phase-locks with periodic
+// events of the network, RFC 2330 11.1 recommends Poisson sampling instead:
+// the gaps are drawn from an exponential distribution, so the sample times
+// cannot be anticipated. All durations are in microseconds.
+class probe_schedule {
+public:
+  enum kind {
+    fixed,   // every gap is the mean
+    poisson, // exponential gaps with the given mean
+    uniform  // mean * (1 + jitter * U(-1, 1))
+  };
+
+  probe_schedule(kind k, std::int64_t mean, double jitter, std::uint64_t seed)
+      : kind_(k), mean_(std::max<std::int64_t>(mean, 1)),
+      jitter_(std::min(std::max(jitter, 0.0), 1.0)),
+      // 2.5 KB a fixed schedule has no use for
+      rng_(k == fixed ? nullptr : new std::mt19937_64(seed)), exp_(1.0), uni_(-1.0, 1.0) {}
+
+  kind type() const { return kind_; }
+  std::int64_t mean() const { return mean_; }
+
+  std::int64_t next_gap() {
+    switch (kind_) {
+      case poisson:
+        return std::llround(mean_ * exp_(*rng_));
+      case uniform:
+        return std::llround(mean_ * (1 + jitter_ * uni_(*rng_)));
+      default:
+        return mean_;
+    }
+  }
+
+private:
+  kind kind_;
+  std::int64_t mean_;
+  double jitter_;
+  std::unique_ptr<std::mt19937_64> rng_;
+  std::exponential_distribution<double> exp_;
+  std::uniform_real_distribution<double> uni_;
+};
+
+
+// Achieved inter-send gaps, to verify the schedule against its distribution.
+//
+// An exponential distribution has a coefficient of variation of 1 and
+// P(gap < mean) = 1 - 1/e = 0.632, a uniform one of jitter/sqrt(3) and 0.5.
+class gap_stats {
+public:
+  void record(std::int64_t gap, std::int64_t lateness, std::int64_t mean) {
+    ++count_;
+    double d = gap - mean_;
+    mean_ += d / count_;
+    m2_ += d * (gap - mean_);
+    min_ = std::min(min_, gap);
+    max_ = std::max(max_, gap);
+    if (gap < mean) ++below_mean_;
+    lateness = std::max<std::int64_t>(lateness, 0);
+    lateness_ += lateness;
+    max_lateness_ = std::max(max_lateness_, lateness);
+  }
+
+  // The next send was already due when a send went out
+  void fell_behind() { ++behind_; }
+
+  std::uint64_t count() const { return count_; }
+  double mean() const { return mean_; }
+  double stddev() const { return count_ > 1 ? std::sqrt(m2_ / (count_ - 1)) : 0; }
+  double cv() const { return mean_ > 0 ? stddev() / mean_ : 0; }
+  double below_mean() const { return count_ ? below_mean_ / static_cast<double>(count_) : 0; }
+  std::int64_t min() const { return count_ ? min_ : 0; }
+  std::int64_t max() const { return max_; }
+  // Delay of the sends after their scheduled time
+  double mean_lateness() const { return count_ ? lateness_ / static_cast<double>(count_) : 0; }
+  std::int64_t max_lateness() const { return max_lateness_; }
+  std::uint64_t behind() const { return behind_; }
+
+private:
+  std::uint64_t count_ = 0;
+  double mean_ = 0;
+  double m2_ = 0;
+  std::int64_t min_ = std::numeric_limits<std::int64_t>::max();
+  std::int64_t max_ = 0;
+  std::uint64_t below_mean_ = 0;
+  std::int64_t lateness_ = 0;
+  std::int64_t max_lateness_ = 0;
+  std::uint64_t behind_ = 0;
+};
+
+}
+
+#endif
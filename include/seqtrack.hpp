@@ -0,0 +1,143 @@
+#ifndef SEQTRACK_HPP
+#define SEQTRACK_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#include "histogram.hpp"
+
+namespace nettool {
+
+// Reordering, duplicates and loss bursts of a target, from the sequence
+// numbers of its replies.
+//
+// As in RFC 4737, a reply is reordered when its sequence number is below the
+// next expected one, the highest seen plus one. Its extent is the number of
+// later probes which arrived before it, estimated by the distance to the
+// highest seen. A bitmap of the last bitmap_bits sequence numbers tells
+// reordered replies from duplicates.
+//
+// Loss runs are lengths of consecutive lost sequence numbers. Losses are
+// declared in sequence order by the timeout, so a run is over when the next
+// loss does not follow it.
+class sequence_tracker {
+public:
+  enum { bitmap_bits = 1024, max_run = 8 };
+
+  // Return false if the reply is a duplicate
+  bool on_reply(unsigned short seq) {
+    if (!started_) {
+      started_ = true;
+      next_expected_ = seq + 1;
+      set(seq);
+      return true;
+    }
+    short d = static_cast<short>(seq - next_expected_);
+    if (d >= 0) {
+      // In order, the skipped sequence numbers have not arrived yet
+      int skipped = std::min<int>(d, bitmap_bits);
+      for (int i = 0; i < skipped; ++i)
+        clear(next_expected_ + i);
+      set(seq);
+      next_expected_ = seq + 1;
+      return true;
+    }
+    int distance = -d;
+    if (distance <= bitmap_bits && test(seq)) {
+      ++duplicates_;
+      return false;
+    }
+    set(seq);
+    ++reordered_;
+    std::uint32_t extent = distance - 1;
+    extent_sum_ += extent;
+    max_extent_ = std::max(max_extent_, extent);
+    return true;
+  }
+
+  void on_duplicate() { ++duplicates_; }
+
+  // A reply of a probe already counted as lost
+  void on_late() { ++late_; }
+
+  void on_loss(unsigned short seq) {
+    if (run_ && seq == static_cast<unsigned short>(last_lost_ + 1)) {
+      ++run_;
+    } else {
+      close_run();
+      run_ = 1;
+    }
+    last_lost_ = seq;
+  }
+
+  std::uint32_t reordered() const { return reordered_; }
+  std::uint32_t duplicates() const { return duplicates_; }
+  std::uint32_t late() const { return late_; }
+  std::uint32_t max_extent() const { return max_extent_; }
+  double mean_extent() const { return reordered_ ? extent_sum_ / static_cast<double>(reordered_) : 0; }
+
+  // Number of loss runs of length 1 .. max_run, the last one counts the
+  // longer runs too. The open run is included.
+  std::uint32_t loss_runs(int length) const {
+    std::uint32_t n = runs_[length - 1];
+    if (run_ && std::min<std::uint32_t>(run_, max_run) == static_cast<std::uint32_t>(length)) ++n;
+    return n;
+  }
+
+private:
+  void close_run() {
+    if (run_) ++runs_[std::min<std::uint32_t>(run_, max_run) - 1];
+    run_ = 0;
+  }
+
+  void set(unsigned short seq) { bitmap_[(seq % bitmap_bits) / 64] |= bit(seq); }
+  void clear(unsigned short seq) { bitmap_[(seq % bitmap_bits) / 64] &= ~bit(seq); }
+  bool test(unsigned short seq) const { return bitmap_[(seq % bitmap_bits) / 64] & bit(seq); }
+  static std::uint64_t bit(unsigned short seq) { return std::uint64_t(1) << (seq % 64); }
+
+  bool started_ = false;
+  unsigned short next_expected_ = 0;
+  std::uint64_t bitmap_[bitmap_bits / 64] = {};
+  std::uint32_t reordered_ = 0;
+  std::uint32_t duplicates_ = 0;
+  std::uint32_t late_ = 0;
+  std::uint64_t extent_sum_ = 0;
+  std::uint32_t max_extent_ = 0;
+
+  unsigned short last_lost_ = 0;
+  std::uint32_t run_ = 0;
+  std::uint32_t runs_[max_run] = {};
+};
+
+// Delay variation of consecutive probes (RFC 3393 IPDV) in nanoseconds.
+//
+// The delay is the round trip time, so the variation is the sum of both
+// directions. The interarrival jitter of RFC 3550, J += (|D| - J) / 16, is
+// kept next to the distribution of |D|.
+class ipdv_stats {
+public:
+  void record(std::int64_t ipdv) {
+    std::uint64_t a = std::llabs(ipdv);
+    ++count_;
+    sum_ += ipdv;
+    jitter_ += (static_cast<double>(a) - jitter_) / 16;
+    histogram_.record(a);
+  }
+
+  std::uint64_t count() const { return count_; }
+  // Mean of the signed variation, close to zero unless the delay trends
+  double mean() const { return count_ ? sum_ / static_cast<double>(count_) : 0; }
+  double jitter() const { return jitter_; }
+  const log_histogram<4, 36>& histogram() const { return histogram_; }
+
+private:
+  std::uint64_t count_ = 0;
+  std::int64_t sum_ = 0;
+  double jitter_ = 0;
+  log_histogram<4, 36> histogram_;
+};
+
+}
+
+#endif
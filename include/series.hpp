@@ -0,0 +1,258 @@
+#ifndef SERIES_HPP
+#define SERIES_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+
+#include "histogram.hpp"
+
+namespace nettool {
+
+// Every probe result of every target, compressed in the spirit of Gorilla
+// (Pelkonen et al., VLDB 2015).
+//
+// A sample is the send time in microseconds since the epoch and the round
+// trip time in microseconds, or a loss. Both are kept within a bound rather
+// than exactly, which is what makes a steady path cost a few bits.
+//
+// A time is predicted from the schedule, the previous time plus the gap of
+// the schedule, and stored as its offset from that prediction in steps of
+// time_step microseconds:
+//   '0'                  on time
+//   '10'   + sign        one step either way, the jitter of a timer
+//   '110'  + 7 bits      -64 .. 63 steps, about 8 ms either way
+//   '1110' + 14 bits     about a second either way
+//   '1111' + 24 bits     about 18 minutes either way, a new chunk beyond
+// A step of jitter leaves the gap alone, a larger offset makes the gap since the
+// previous time the new gap: a pause, or the first gap of a chunk. The
+// prediction starts from the stored time, not the exact one, so the error
+// of a time stays within half a step instead of adding up.
+//
+// A round trip time is quantized to its bucket of a rtt_histogram, exact
+// below 128 us and at most 1.6% wide above, read back as the middle of the
+// bucket, so within 0.8%. It is stored as the change to the previous bucket:
+//   '0'                  same bucket
+//   '10'    + sign       one bucket either way
+//   '110'   + 3 bits     -4 .. 3
+//   '1110'  + 5 bits     -16 .. 15
+//   '11110' + 8 bits     -128 .. 127
+//   '11111' + 11 bits    bucket + 1, or 0 for a loss
+// A sample on a steady path, a few buckets of noise and a timer within a
+// step, takes 3 to 5 bits instead of 16 bytes: a day of 1 Hz probes of 10k
+// targets is 300 to 500 MB. Noise of many buckets costs more, up to 11 bits
+// a sample for loopback, where the buckets are a microsecond wide.
+//
+// Samples are appended to chunks of chunk_bytes, the first sample of a chunk
+// is kept in its header with its exact time. A full chunk is sealed and
+// queued in a FIFO shared by all targets, so when the store goes over its
+// memory budget the oldest sealed chunk of any target is dropped.
+class series_store {
+public:
+  enum { chunk_bytes = 1024, time_step = 128 };
+  using rtt_histogram = log_histogram<7, 32>;
+
+  // Budget in bytes
+  explicit series_store(std::size_t budget) : budget_(budget), chunks_(0), evicted_(0) {}
+
+  std::size_t add() {
+    series_.emplace_back();
+    return series_.size() - 1;
+  }
+
+  // A negative round trip time is a loss
+  void record(std::size_t id, std::int64_t time, std::int64_t rtt) {
+    series& s = series_[id];
+    std::uint16_t code = rtt < 0 ? 0 : rtt_histogram::index(rtt) + 1;
+    if (s.chunks.empty() || !append(*s.chunks.back(), time, code)) {
+      if (!s.chunks.empty()) sealed_.push_back(id);
+      s.chunks.emplace_back(new chunk(time, code));
+      ++chunks_;
+      evict();
+    }
+    ++s.samples;
+  }
+
+  // Call f(time, rtt) for the samples of [from, to) in the order recorded,
+  // rtt is the middle of its bucket or -1 for a loss
+  template<typename F>
+  void query(std::size_t id, std::int64_t from, std::int64_t to, F f) const {
+    for (const auto& c : series_[id].chunks) {
+      if (c->max_time < from || c->min_time >= to) continue;
+      reader r(*c);
+      for (std::uint32_t i = 0; i < c->count; ++i) {
+        r.next();
+        if (r.time >= from && r.time < to)
+          f(r.time, r.code ? decode(r.code) : -1);
+      }
+    }
+  }
+
+  std::size_t bytes() const { return chunks_ * sizeof(chunk); }
+  std::size_t budget() const { return budget_; }
+  // Samples recorded and those still stored
+  std::uint64_t recorded(std::size_t id) const { return series_[id].samples; }
+  std::uint64_t stored(std::size_t id) const {
+    std::uint64_t n = 0;
+    for (const auto& c : series_[id].chunks) n += c->count;
+    return n;
+  }
+  std::uint64_t bits(std::size_t id) const {
+    std::uint64_t n = 0;
+    for (const auto& c : series_[id].chunks) n += c->bits;
+    return n;
+  }
+  std::uint64_t evicted() const { return evicted_; }
+
+private:
+  enum { header_bytes = 64, chunk_words = (chunk_bytes - header_bytes) / 8, max_sample_bits = 4 + 24 + 5 + 11 };
+
+  struct chunk {
+    chunk(std::int64_t time, std::uint16_t code)
+        : first_time(time), last_time(time), min_time(time), max_time(time), last_delta(0),
+        count(1), bits(0), first_code(code), last_code(code) {
+      std::memset(words, 0, sizeof(words));
+    }
+
+    // Times as stored, the first one exact
+    std::int64_t first_time;
+    std::int64_t last_time;
+    std::int64_t min_time;
+    std::int64_t max_time;
+    std::int64_t last_delta;
+    std::uint32_t count;
+    std::uint32_t bits;
+    std::uint16_t first_code;
+    std::uint16_t last_code;
+    std::uint64_t words[chunk_words];
+  };
+  static_assert(sizeof(chunk) <= chunk_bytes, "chunk layout");
+  static_assert(offsetof(chunk, words) <= header_bytes, "chunk header");
+
+  struct series {
+    std::deque<std::unique_ptr<chunk>> chunks;
+    std::uint64_t samples = 0;
+  };
+
+  struct reader {
+    explicit reader(const chunk& c) : c(c), pos(0), time(c.first_time), delta(0), code(c.first_code), first(true) {}
+
+    void next() {
+      if (first) {
+        first = false;
+        return;
+      }
+      static const int time_widths[] = {0, 0, 7, 14, 24};
+      static const int code_widths[] = {0, 0, 3, 5, 8};
+      int k = prefix(4);
+      std::int64_t off = k == 1 ? sign() * time_step : k ? signed_field(time_widths[k]) * time_step : 0;
+      time += delta + off;
+      if (k > 1) delta += off;
+      k = prefix(5);
+      if (k == 5) code = get(11);
+      else if (k == 1) code += sign();
+      else if (k) code += signed_field(code_widths[k]);
+    }
+
+    // Number of leading ones, up to max
+    int prefix(int max) {
+      int k = 0;
+      while (k < max && get(1)) ++k;
+      return k;
+    }
+
+    int sign() { return get(1) ? -1 : 1; }
+
+    std::int64_t signed_field(int n) {
+      return static_cast<std::int64_t>(get(n) << (64 - n)) >> (64 - n);
+    }
+
+    std::uint64_t get(int n) {
+      int w = pos / 64, o = pos % 64;
+      std::uint64_t v = c.words[w] >> o;
+      if (o + n > 64) v |= c.words[w + 1] << (64 - o);
+      pos += n;
+      return v & ((std::uint64_t(1) << n) - 1);
+    }
+
+    const chunk& c;
+    std::uint32_t pos;
+    std::int64_t time;
+    std::int64_t delta;
+    std::uint16_t code;
+    bool first;
+  };
+
+  static bool fits(std::int64_t v, int n) {
+    return v >= -(std::int64_t(1) << (n - 1)) && v < (std::int64_t(1) << (n - 1));
+  }
+
+  static std::int64_t decode(std::uint16_t code) {
+    int i = code - 1;
+    return rtt_histogram::lower_bound(i) + (rtt_histogram::bucket_width(i) - 1) / 2;
+  }
+
+  static void put(chunk& c, std::uint64_t v, int n) {
+    v &= (std::uint64_t(1) << n) - 1;
+    int w = c.bits / 64, o = c.bits % 64;
+    c.words[w] |= v << o;
+    if (o + n > 64) c.words[w + 1] |= v >> (64 - o);
+    c.bits += n;
+  }
+
+  // Return false if the chunk is full
+  static bool append(chunk& c, std::int64_t time, std::uint16_t code) {
+    // Steps off the prediction, rounded to the nearest
+    std::int64_t off = time - (c.last_time + c.last_delta);
+    std::int64_t steps = (off + (off >= 0 ? time_step / 2 : -time_step / 2)) / time_step;
+    if (c.bits + max_sample_bits > chunk_words * 64 || !fits(steps, 24)) return false;
+
+    if (steps == 0) put(c, 0, 1);
+    else if (steps == 1 || steps == -1) { put(c, 0x1, 2); put(c, steps < 0, 1); }
+    else if (fits(steps, 7)) { put(c, 0x3, 3); put(c, steps, 7); }
+    else if (fits(steps, 14)) { put(c, 0x7, 4); put(c, steps, 14); }
+    else { put(c, 0xF, 4); put(c, steps, 24); }
+
+    int d = code - c.last_code;
+    if (d == 0) put(c, 0, 1);
+    else if (d == 1 || d == -1) { put(c, 0x1, 2); put(c, d < 0, 1); }
+    else if (fits(d, 3)) { put(c, 0x3, 3); put(c, d, 3); }
+    else if (fits(d, 5)) { put(c, 0x7, 4); put(c, d, 5); }
+    else if (fits(d, 8)) { put(c, 0xF, 5); put(c, d, 8); }
+    else { put(c, 0x1F, 5); put(c, code, 11); }
+
+    // What the reader will see
+    c.last_time += c.last_delta + steps * time_step;
+    if (steps < -1 || steps > 1) c.last_delta += steps * time_step;
+    c.last_code = code;
+    c.min_time = std::min(c.min_time, c.last_time);
+    c.max_time = std::max(c.max_time, c.last_time);
+    ++c.count;
+    return true;
+  }
+
+  // Drop the oldest sealed chunks while over the budget, the open chunk of
+  // a target always stays
+  void evict() {
+    while (bytes() > budget_ && !sealed_.empty()) {
+      series& s = series_[sealed_.front()];
+      sealed_.pop_front();
+      evicted_ += s.chunks.front()->count;
+      s.chunks.pop_front();
+      --chunks_;
+    }
+  }
+
+  std::size_t budget_;
+  std::deque<series> series_;
+  std::deque<std::size_t> sealed_;
+  std::size_t chunks_;
+  std::uint64_t evicted_;
+};
+
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef SHM_HPP
+#define SHM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nettool {
+
+// Live statistics of every target in a POSIX shared memory segment.
+//
+// Layout, in the byte order of the host, every offset from the start:
+//
+//   0     char[8]   magic "NTSHMSTA"
+//   8     u32       version
+//   12    u32       size of an entry (128)
+//   16    u64       number of targets
+//   24    u64       pid of the writer
+//   32    u64       start time (ns since the epoch)
+//   40    u64       offset of the names, 64
+//   48    u64       offset of the entries, a multiple of 64
+//   names: per target char[64] host and char[16] address, NUL padded
+//   entries: per target 16 u64, one on two cache lines of its own:
+//     sequence, sent, received, lost, last rtt, srtt, rttvar, rto,
+//     rtt min, rtt max, rtt mean, time of the update, reserved[4]
+//   times in ns, rtt min is 0 until the first reply
+//
+// Every entry is a seqlock. The writer makes the sequence odd, stores the
+// fields and makes it even again; a reader copies the fields between two
+// loads of the sequence and retries if it was odd or has changed. Readers
+// never write to the segment, so however often they poll they cannot delay
+// the writer: they only cost it the cache misses of the lines they read.
+struct shm_entry {
+  std::uint64_t sent;
+  std::uint64_t received;
+  std::uint64_t lost;
+  std::uint64_t last_rtt;
+  std::uint64_t srtt;
+  std::uint64_t rttvar;
+  std::uint64_t rto;
+  std::uint64_t rtt_min;
+  std::uint64_t rtt_max;
+  std::uint64_t rtt_mean;
+  std::uint64_t updated;
+};
+
+class shm_stats {
+public:
+  static constexpr char magic[8] = {'N', 'T', 'S', 'H', 'M', 'S', 'T', 'A'};
+  enum { version = 1, host_bytes = 64, address_bytes = 16, name_bytes = host_bytes + address_bytes };
+  // Attempts of a reader before it gives up on an entry
+  enum { max_attempts = 1 << 20 };
+
+  struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t entry_size;
+    std::uint64_t targets;
+    std::uint64_t pid;
+    std::uint64_t started;
+    std::uint64_t names_offset;
+    std::uint64_t entries_offset;
+  };
+
+  struct alignas(64) slot {
+    std::atomic<std::uint64_t> sequence;
+    std::atomic<std::uint64_t> fields[15];
+  };
+  static_assert(sizeof(slot) == 128, "the entry size is part of the layout");
+  static_assert(sizeof(shm_entry) <= sizeof(slot::fields), "an entry fits its slot");
+
+  // Create or replace the segment name ("/ping") for targets, throw
+  // std::runtime_error if it cannot be mapped. The segment is removed with
+  // the writer unless it is kept, a reader may still map it.
+  shm_stats(const std::string& name, std::size_t targets, std::uint64_t started, bool keep = false)
+      : name_(name), unlink_(!keep) {
+    std::uint64_t entries = (64 + targets * name_bytes + 63) / 64 * 64;
+    size_ = entries + targets * sizeof(slot);
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) fail("cannot open shared memory " + name);
+    if (::ftruncate(fd, size_) < 0) {
+      ::close(fd);
+      ::shm_unlink(name.c_str());
+      fail("cannot size shared memory " + name);
+    }
+    try {
+      map(fd, PROT_READ | PROT_WRITE);
+    } catch (...) {
+      ::shm_unlink(name.c_str());
+      throw;
+    }
+    header* h = reinterpret_cast<header*>(base_);
+    std::memcpy(h->magic, magic, sizeof(magic));
+    h->version = version;
+    h->entry_size = sizeof(slot);
+    h->targets = targets;
+    h->pid = ::getpid();
+    h->started = started;
+    h->names_offset = 64;
+    h->entries_offset = entries;
+    header_ = h;
+    slots_ = reinterpret_cast<slot*>(base_ + entries);
+    for (std::size_t i = 0; i < targets; ++i)
+      new (&slots_[i]) slot();
+  }
+
+  // Open an existing segment read only
+  explicit shm_stats(const std::string& name) : name_(name), unlink_(false) {
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) fail("cannot open shared memory " + name);
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || static_cast<std::size_t>(st.st_size) < sizeof(header)) {
+      ::close(fd);
+      throw std::runtime_error(name + " is not a statistics segment");
+    }
+    size_ = st.st_size;
+    map(fd, PROT_READ);
+    header_ = reinterpret_cast<header*>(base_);
+    const header& h = *header_;
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version
+        || h.entry_size != sizeof(slot) || h.entries_offset % 64 != 0
+        || h.names_offset + h.targets * name_bytes > h.entries_offset
+        || h.entries_offset + h.targets * sizeof(slot) > size_) {
+      ::munmap(base_, size_);
+      throw std::runtime_error(name + " is not a statistics segment");
+    }
+    slots_ = reinterpret_cast<slot*>(base_ + h.entries_offset);
+  }
+
+  ~shm_stats() {
+    ::munmap(base_, size_);
+    if (unlink_) ::shm_unlink(name_.c_str());
+  }
+
+  shm_stats(const shm_stats&) = delete;
+  shm_stats& operator=(const shm_stats&) = delete;
+
+  std::size_t targets() const { return header_->targets; }
+  std::uint64_t pid() const { return header_->pid; }
+  std::uint64_t started() const { return header_->started; }
+
+  void set_name(std::size_t id, const std::string& host, const std::string& address) {
+    char* p = base_ + header_->names_offset + id * name_bytes;
+    std::memset(p, 0, name_bytes);
+    std::memcpy(p, host.data(), std::min<std::size_t>(host.size(), host_bytes - 1));
+    std::memcpy(p + host_bytes, address.data(), std::min<std::size_t>(address.size(), address_bytes - 1));
+  }
+
+  std::string host(std::size_t id) const {
+    const char* p = base_ + header_->names_offset + id * name_bytes;
+    return std::string(p, strnlen(p, host_bytes));
+  }
+
+  std::string address(std::size_t id) const {
+    const char* p = base_ + header_->names_offset + id * name_bytes + host_bytes;
+    return std::string(p, strnlen(p, address_bytes));
+  }
+
+  // Writer: publish the entry of a target
+  void publish(std::size_t id, const shm_entry& e) {
+    slot& s = slots_[id];
+    std::uint64_t seq = s.sequence.load(std::memory_order_relaxed);
+    s.sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    const std::uint64_t* v = reinterpret_cast<const std::uint64_t*>(&e);
+    for (std::size_t i = 0; i < sizeof(e) / sizeof(std::uint64_t); ++i)
+      s.fields[i].store(v[i], std::memory_order_relaxed);
+    s.sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  // Reader: a consistent copy of the entry of a target, counting in
+  // retries the attempts which met an update. Return false if the entry
+  // stays in the middle of an update, as if its writer died there.
+  bool read(std::size_t id, shm_entry& e, std::uint64_t& retries) const {
+    const slot& s = slots_[id];
+    std::uint64_t* v = reinterpret_cast<std::uint64_t*>(&e);
+    for (unsigned attempt = 0; attempt < max_attempts; ++attempt) {
+      std::uint64_t before = s.sequence.load(std::memory_order_acquire);
+      if ((before & 1) == 0) {
+        for (std::size_t i = 0; i < sizeof(e) / sizeof(std::uint64_t); ++i)
+          v[i] = s.fields[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.sequence.load(std::memory_order_relaxed) == before) return true;
+      }
+      ++retries;
+    }
+    return false;
+  }
+
+private:
+  void map(int fd, int prot) {
+    void* p = ::mmap(nullptr, size_, prot, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) fail("cannot map shared memory " + name_);
+    base_ = static_cast<char*>(p);
+  }
+
+  static void fail(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+
+  std::string name_;
+  bool unlink_;
+  std::size_t size_;
+  char* base_;
+  header* header_;
+  slot* slots_;
+};
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef NETTOOL_SINK_H
+#define NETTOOL_SINK_H
+
+/*
+ * Result sinks: shared libraries loaded by ping --sink, which receive the
+ * probe results in batches.
+ *
+ * A batch is a contiguous array of fixed size records in memory owned by
+ * ping. The sink owns a batch from the call of consume() until it passes
+ * it to host->release(), which it may do later and from any thread; ping
+ * writes into a batch again only once it is released. consume() runs on
+ * the probing thread and should only queue the batch. While every batch
+ * is held by the sink, new results are dropped and counted rather than
+ * waited for.
+ *
+ * A sink exports a struct nettool_sink named nettool_sink:
+ *
+ *   const struct nettool_sink nettool_sink = {
+ *     NETTOOL_SINK_ABI_VERSION, "name", my_open, my_consume, my_close
+ *   };
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NETTOOL_SINK_ABI_VERSION 1
+#define NETTOOL_SINK_SYMBOL "nettool_sink"
+
+enum nettool_outcome {
+  NETTOOL_REPLY = 0,
+  NETTOOL_TIMEOUT = 1,
+  NETTOOL_ERROR = 2
+};
+
+/* One probe, 32 bytes */
+struct nettool_result {
+  /* Send time in ns since the epoch */
+  uint64_t sent;
+  /* Round trip time in ns, 0 unless a reply */
+  uint64_t rtt;
+  /* Index into host->targets */
+  uint32_t target;
+  /* IPv4 address of the target in host byte order */
+  uint32_t address;
+  uint16_t sequence;
+  /* enum nettool_outcome */
+  uint8_t outcome;
+  /* TTL of a reply */
+  uint8_t ttl;
+  /* Bytes of a reply */
+  uint16_t bytes;
+  uint16_t reserved;
+};
+
+/* Names of a target, NUL terminated */
+struct nettool_target {
+  const char* host;
+  const char* address;
+};
+
+struct nettool_batch {
+  const struct nettool_result* results;
+  uint32_t count;
+  /* Entries of host->targets set when the batch was handed over */
+  uint32_t target_count;
+  /* Number of the batch, from 0 */
+  uint64_t sequence;
+  /* Results dropped since the previous batch for want of a free batch */
+  uint64_t dropped;
+};
+
+struct nettool_host {
+  uint32_t abi_version;
+  /* Give a batch back, from any thread */
+  void (*release)(const struct nettool_host* host, const struct nettool_batch* batch);
+  /* Names by target id, valid until close() returns; targets may be added
+     while ping runs, see nettool_batch.target_count */
+  const struct nettool_target* targets;
+  void* context;
+};
+
+struct nettool_sink {
+  uint32_t abi_version;
+  const char* name;
+  /* Return the state of the sink, or NULL if it cannot start. config is
+     the string given to --sink-config, empty if none. */
+  void* (*open)(const struct nettool_host* host, const char* config);
+  void (*consume)(void* sink, const struct nettool_batch* batch);
+  /* Called once every batch has been released */
+  void (*close)(void* sink);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef SINK_HPP
+#define SINK_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dlfcn.h>
+
+#include "sink.h"
+
+namespace nettool {
+
+// A result sink loaded from a shared library, see sink.h.
+//
+// Results are appended to the current batch of a fixed pool, nothing is
+// allocated or copied per result after construction. A full batch, or the
+// current one on flush(), is handed to the sink and comes back through
+// release(); until then the sink reads it in place. The flag of a batch is
+// set by the probing thread when it hands the batch over and cleared by
+// release(). Everything the threads of the sink may reach lives in one
+// block, which is leaked rather than freed if the sink never gives its
+// batches back.
+class result_sink {
+public:
+  enum { batch_results = 4096, batch_count = 16 };
+
+  // Load the sink and open it for up to targets targets, throw
+  // std::runtime_error if it cannot be loaded or does not start
+  result_sink(const std::string& path, const std::string& config, std::size_t targets)
+      : shared_(new shared(targets)), current_(nullptr), next_(0), sequence_(0), dropped_(0), target_count_(0) {
+    library_ = ::dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!library_) throw std::runtime_error(std::string("cannot load sink: ") + ::dlerror());
+    sink_ = static_cast<const nettool_sink*>(::dlsym(library_, NETTOOL_SINK_SYMBOL));
+    if (!sink_ || sink_->abi_version != NETTOOL_SINK_ABI_VERSION) {
+      ::dlclose(library_);
+      throw std::runtime_error(path + ": no " NETTOOL_SINK_SYMBOL " of ABI version "
+          + std::to_string(NETTOOL_SINK_ABI_VERSION));
+    }
+    state_ = sink_->open(&shared_->host, config.c_str());
+    if (!state_) {
+      ::dlclose(library_);
+      throw std::runtime_error(path + ": sink " + sink_->name + " did not start");
+    }
+  }
+
+  // Hand over the last results, wait for every batch to come back and
+  // close the sink. A sink which keeps a batch is neither closed nor
+  // unloaded, and what it may still reach is not freed.
+  ~result_sink() {
+    flush();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (held() && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (held()) {
+      std::cerr << "sink " << sink_->name << " keeps its batches, not closed" << std::endl;
+      shared_.release();
+      return;
+    }
+    sink_->close(state_);
+    ::dlclose(library_);
+  }
+
+  result_sink(const result_sink&) = delete;
+  result_sink& operator=(const result_sink&) = delete;
+
+  const char* name() const { return sink_->name; }
+  std::uint64_t dropped() const { return dropped_total_; }
+  std::uint64_t batches() const { return sequence_; }
+
+  // Name a target, ids are given in order
+  void set_target(std::size_t id, const std::string& host, const std::string& address) {
+    shared& s = *shared_;
+    s.hosts[id] = host;
+    s.addresses[id] = address;
+    s.names[id].host = s.hosts[id].c_str();
+    s.names[id].address = s.addresses[id].c_str();
+    target_count_ = std::max<std::uint32_t>(target_count_, id + 1);
+  }
+
+  void append(const nettool_result& r) {
+    if (!current_ && !take()) {
+      ++dropped_;
+      ++dropped_total_;
+      return;
+    }
+    shared_->results[(current_ - shared_->batches) * batch_results + current_->count++] = r;
+    if (current_->count == batch_results)
+      submit();
+  }
+
+  // True if a result appended now would not be dropped
+  bool ready() { return current_ || take(); }
+
+  // Hand over the current batch even if it is not full
+  void flush() {
+    if (current_ && current_->count)
+      submit();
+  }
+
+private:
+  struct shared {
+    explicit shared(std::size_t targets)
+        : hosts(targets), addresses(targets), names(targets),
+        results(new nettool_result[batch_count * batch_results]) {
+      for (std::size_t i = 0; i < batch_count; ++i) {
+        batches[i].results = results.get() + i * batch_results;
+        held[i].store(false, std::memory_order_relaxed);
+      }
+      host.abi_version = NETTOOL_SINK_ABI_VERSION;
+      host.release = &result_sink::release;
+      host.targets = names.data();
+      host.context = this;
+    }
+
+    nettool_host host;
+    std::vector<std::string> hosts;
+    std::vector<std::string> addresses;
+    std::vector<nettool_target> names;
+    std::unique_ptr<nettool_result[]> results;
+    nettool_batch batches[batch_count];
+    std::atomic<bool> held[batch_count];
+  };
+
+  // Start filling the next free batch, in turn
+  bool take() {
+    for (std::size_t n = 0; n < batch_count; ++n) {
+      std::size_t i = (next_ + n) % batch_count;
+      if (shared_->held[i].load(std::memory_order_acquire)) continue;
+      next_ = (i + 1) % batch_count;
+      current_ = &shared_->batches[i];
+      current_->count = 0;
+      return true;
+    }
+    return false;
+  }
+
+  void submit() {
+    nettool_batch* b = current_;
+    current_ = nullptr;
+    b->target_count = target_count_;
+    b->sequence = sequence_++;
+    b->dropped = dropped_;
+    dropped_ = 0;
+    shared_->held[b - shared_->batches].store(true, std::memory_order_release);
+    sink_->consume(state_, b);
+  }
+
+  bool held() const {
+    for (std::size_t i = 0; i < batch_count; ++i) {
+      if (shared_->held[i].load(std::memory_order_acquire)) return true;
+    }
+    return false;
+  }
+
+  static void release(const nettool_host* host, const nettool_batch* batch) {
+    shared* s = static_cast<shared*>(host->context);
+    s->held[batch - s->batches].store(false, std::memory_order_release);
+  }
+
+  void* library_;
+  const nettool_sink* sink_;
+  void* state_;
+  std::unique_ptr<shared> shared_;
+  nettool_batch* current_;
+  std::size_t next_;
+  std::uint64_t sequence_;
+  // Since the last batch handed over, and in all
+  std::uint64_t dropped_;
+  std::uint64_t dropped_total_ = 0;
+  std::uint32_t target_count_;
+};
+
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef SLA_HPP
+#define SLA_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace nettool {
+
+// A threshold on a metric of a target over a sliding window, written as
+//   [<scope>:]<metric> > <threshold> over <window>
+// with metric loss, avg or p<N>, e.g. "loss > 2% over 60s", "p99>20ms/5m" or
+// "all:avg>50ms/1m". Spaces are optional and "/" may stand for "over".
+// Without a scope the rule applies to every target on its own, with one it
+// applies to the events of a group of targets together, "all" being every
+// target.
+struct sla_rule {
+  enum kind { loss, percentile, mean };
+
+  kind metric = loss;
+  double percentile_rank = 0;
+  // Fraction for loss, nanoseconds otherwise
+  double threshold = 0;
+  // Milliseconds
+  std::int64_t window = 0;
+  // Empty for every target
+  std::string scope;
+  std::string text;
+
+  static sla_rule parse(const std::string& arg) {
+    std::string s;
+    for (char c : arg)
+      if (!std::isspace(static_cast<unsigned char>(c))) s += c;
+    sla_rule r;
+    std::size_t colon = s.find(':'), gt = s.find('>');
+    if (gt == std::string::npos)
+      throw std::invalid_argument("invalid rule: " + arg);
+    if (colon < gt) {
+      r.scope = s.substr(0, colon);
+      s.erase(0, colon + 1);
+      gt -= colon + 1;
+    }
+    std::size_t over = s.find("over", gt);
+    if (over != std::string::npos)
+      s.replace(over, 4, "/");
+    r.text = (r.scope.empty() ? "" : r.scope + ":") + s;
+    std::size_t slash = s.find('/', gt);
+    if (slash == std::string::npos)
+      throw std::invalid_argument("invalid rule: " + arg);
+
+    std::string name = s.substr(0, gt);
+    if (name == "loss") {
+      r.metric = loss;
+    } else if (name == "avg") {
+      r.metric = mean;
+    } else if (name.size() > 1 && name[0] == 'p') {
+      r.metric = percentile;
+      r.percentile_rank = number(name.substr(1), arg);
+      if (r.percentile_rank <= 0 || r.percentile_rank >= 100)
+        throw std::invalid_argument("invalid percentile: " + arg);
+    } else {
+      throw std::invalid_argument("invalid rule metric: " + arg);
+    }
+
+    std::string value = s.substr(gt + 1, slash - gt - 1);
+    if (r.metric == loss) {
+      if (value.empty() || value.back() != '%')
+        throw std::invalid_argument("loss threshold is a percentage: " + arg);
+      r.threshold = number(value.substr(0, value.size() - 1), arg) / 100;
+    } else {
+      r.threshold = duration(value, arg) * 1e6;
+    }
+    r.window = static_cast<std::int64_t>(duration(s.substr(slash + 1), arg));
+    if (r.window < slot_count)
+      throw std::invalid_argument("rule window too short: " + arg);
+    return r;
+  }
+
+  enum { slot_count = 10 };
+
+private:
+  static double number(const std::string& s, const std::string& arg) {
+    char* end = nullptr;
+    double v = std::strtod(s.c_str(), &end);
+    if (s.empty() || *end != '\0' || v < 0)
+      throw std::invalid_argument("invalid number in rule: " + arg);
+    return v;
+  }
+
+  // Milliseconds of "20ms", "1.5s", "5m" or "1h"
+  static double duration(const std::string& s, const std::string& arg) {
+    static const struct { const char* suffix; double scale; } units[] = {
+      {"ms", 1}, {"s", 1e3}, {"m", 60e3}, {"h", 3600e3}
+    };
+    for (const auto& u : units) {
+      std::size_t n = std::char_traits<char>::length(u.suffix);
+      if (s.size() > n && s.compare(s.size() - n, n, u.suffix) == 0)
+        return number(s.substr(0, s.size() - n), arg) * u.scale;
+    }
+    throw std::invalid_argument("invalid duration in rule: " + arg);
+  }
+};
+
+// Evaluates rules as replies and losses arrive.
+//
+// Every rule reduces to a ratio over its window: lost probes of all probes,
+// replies above the threshold of all replies (p<N> exceeds the threshold
+// when more than 100 - N percent do), or the sum of round trip times of all
+// replies. The window is a ring of slot_count slots of counts, with running
+// totals, so an event costs a constant amount of work: expire the slots the
+// clock moved past, add to the current one, compare. A rule only fires once
+// its window has been observed in full, and only a change of state is
+// reported.
+class sla_engine {
+public:
+  // Target of a scoped rule
+  static constexpr std::size_t scope_target = static_cast<std::size_t>(-1);
+
+  struct transition {
+    const sla_rule& rule;
+    std::size_t target;
+    bool firing;
+    // Loss or fraction above the threshold, or mean in nanoseconds
+    double value;
+  };
+
+  explicit sla_engine(const std::vector<sla_rule>& rules) : rules_(rules), states_(rules.size()) {}
+
+  bool empty() const { return rules_.empty(); }
+
+  const std::vector<sla_rule>& rules() const { return rules_; }
+
+  // Make room for the targets [0, count), a scoped rule covers all of them
+  // unless restricted
+  void resize(std::size_t count) {
+    for (std::size_t i = 0; i < rules_.size(); ++i)
+      states_[i].resize(rules_[i].scope.empty() ? count : 1);
+    members_.resize(rules_.size());
+  }
+
+  // Evaluate a scoped rule over the events of these targets only
+  void restrict(std::size_t rule, const std::vector<bool>& members) {
+    members_[rule] = members;
+  }
+
+  // Add a target to or remove it from a restricted rule
+  void set_member(std::size_t rule, std::size_t id, bool member) {
+    members_[rule][id] = member;
+  }
+
+  // now in milliseconds, report is called with a transition
+  template<typename F>
+  void on_reply(std::size_t id, std::int64_t now, std::uint64_t rtt, F report) {
+    for (std::size_t i = 0; i < rules_.size(); ++i) {
+      const sla_rule& r = rules_[i];
+      std::uint64_t value = 0;
+      switch (r.metric) {
+        case sla_rule::loss: break;
+        case sla_rule::percentile: value = rtt > r.threshold; break;
+        case sla_rule::mean: value = rtt; break;
+      }
+      update(i, id, now, true, value, report);
+    }
+  }
+
+  template<typename F>
+  void on_loss(std::size_t id, std::int64_t now, F report) {
+    for (std::size_t i = 0; i < rules_.size(); ++i)
+      // A lost probe has no round trip time to compare
+      update(i, id, now, rules_[i].metric == sla_rule::loss, 1, report);
+  }
+
+private:
+  struct state {
+    std::int64_t start = -1;
+    std::int64_t slot = 0;
+    bool firing = false;
+    std::uint32_t events_total = 0;
+    std::uint64_t value_total = 0;
+    std::uint32_t events[sla_rule::slot_count] = {};
+    std::uint64_t values[sla_rule::slot_count] = {};
+  };
+
+  template<typename F>
+  void update(std::size_t i, std::size_t id, std::int64_t now, bool counted,
+      std::uint64_t value, F& report) {
+    const sla_rule& r = rules_[i];
+    if (!members_[i].empty() && !members_[i][id]) return;
+    state& s = states_[i][r.scope.empty() ? id : 0];
+    std::int64_t slot = now / (r.window / sla_rule::slot_count);
+    if (s.start < 0) {
+      s.start = now;
+      s.slot = slot;
+    }
+    // Expire the slots between the last event and this one
+    std::int64_t expired = std::min<std::int64_t>(slot - s.slot, sla_rule::slot_count);
+    for (std::int64_t k = 1; k <= expired; ++k) {
+      std::size_t j = (s.slot + k) % sla_rule::slot_count;
+      s.events_total -= s.events[j];
+      s.value_total -= s.values[j];
+      s.events[j] = 0;
+      s.values[j] = 0;
+    }
+    s.slot = std::max(s.slot, slot);
+    if (counted) {
+      std::size_t j = s.slot % sla_rule::slot_count;
+      ++s.events[j];
+      ++s.events_total;
+      s.values[j] += value;
+      s.value_total += value;
+    }
+
+    if (now - s.start < r.window || s.events_total == 0) return;
+    double v = static_cast<double>(s.value_total) / s.events_total;
+    bool firing;
+    switch (r.metric) {
+      case sla_rule::percentile: firing = v > 1 - r.percentile_rank / 100; break;
+      default: firing = v > r.threshold; break;
+    }
+    if (firing != s.firing) {
+      s.firing = firing;
+      report(transition{r, r.scope.empty() ? id : scope_target, firing, v});
+    }
+  }
+
+  std::vector<sla_rule> rules_;
+  // Rule, then target
+  std::vector<std::vector<state>> states_;
+  // Rule, then target, empty if the rule covers every target
+  std::vector<std::vector<bool>> members_;
+};
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef STATE_HPP
+#define STATE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "histogram.hpp"
+#include "stats.hpp"
+
+namespace nettool {
+
+// What a target needs besides its statistics to resume where it stopped:
+// its name, to be found again, and its timeout estimator and sequence
+// number, so it does not start over from the upper bound of the timeout
+struct state_target {
+  char host[64];
+  char address[16];
+  // Labels as given after the @ or to tag, "eu/fra,db"
+  char labels[136];
+  // Microseconds
+  std::int64_t srtt;
+  std::int64_t rttvar;
+  std::int64_t rto;
+  // Nanoseconds
+  std::uint64_t last_rtt;
+  std::uint16_t sequence;
+  std::uint8_t active;
+  std::uint8_t reserved[5];
+};
+static_assert(sizeof(state_target) == 256, "state_target is stored as is");
+
+// Statistics and adaptive state of every target and group in a file mapped
+// into memory, so a restarted ping carries on from it.
+//
+// The file is, in the byte order of the host, with every part on a page of
+// its own:
+//
+//   char[8]   magic "NTSTATE_"
+//   u32, u32  version and size of a state_target
+//   u64       size of a latency histogram
+//   u64, u64  target and group capacity
+//   u64, u64  targets and groups in use
+//   u64       creation time (ns since the epoch)
+//   u64       offsets of the target slots, group names, target statistics
+//             and group statistics
+//   state_target per target slot
+//   char[64] per group slot
+//   a stats_store of the target capacity, and one of the group capacity
+//
+// The stores work on the mapping directly, so an update is the same few
+// stores as in memory and nothing is written at exit: the kernel writes the
+// dirty pages back, a crash loses nothing. Opening a file that fits is one
+// mmap, no slot is read or initialized until a target uses it. A file of
+// another version or layout, or too small for the targets asked for, is
+// replaced by an empty one.
+class state_file {
+public:
+  static constexpr char magic[8] = {'N', 'T', 'S', 'T', 'A', 'T', 'E', '_'};
+  enum { version = 1, page = 4096, group_bytes = 64 };
+
+  struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t target_size;
+    std::uint64_t histogram_size;
+    std::uint64_t target_capacity;
+    std::uint64_t group_capacity;
+    std::uint64_t targets;
+    std::uint64_t groups;
+    std::uint64_t created;
+    std::uint64_t targets_offset;
+    std::uint64_t groups_offset;
+    std::uint64_t target_stats_offset;
+    std::uint64_t group_stats_offset;
+  };
+
+  // Open the file at path if it holds the state of at least targets and
+  // groups, else create it empty. Throw std::runtime_error if it cannot be
+  // mapped.
+  state_file(const std::string& path, std::size_t targets, std::size_t groups, std::uint64_t created)
+      : path_(path), base_(nullptr), attached_(false) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) fail("cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+      ::close(fd);
+      fail("cannot open " + path);
+    }
+    header h;
+    if (static_cast<std::size_t>(st.st_size) >= sizeof(h) && ::pread(fd, &h, sizeof(h), 0) == sizeof(h))
+      attached_ = fits(h, st.st_size, targets, groups);
+    if (attached_) {
+      size_ = st.st_size;
+    } else {
+      if (st.st_size > 0)
+        reason_ = path + " is not a state file or does not fit, starting afresh";
+      h = layout(targets, groups, created);
+      size_ = h.group_stats_offset + stats_store::bytes(groups);
+      // Emptied first, a new file is a hole and costs no disk until used
+      if (::ftruncate(fd, 0) < 0 || ::ftruncate(fd, size_) < 0) {
+        ::close(fd);
+        fail("cannot size " + path);
+      }
+    }
+    void* p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) fail("cannot map " + path);
+    base_ = static_cast<char*>(p);
+    header_ = reinterpret_cast<header*>(base_);
+    if (!attached_) *header_ = h;
+    targets_ = reinterpret_cast<state_target*>(base_ + header_->targets_offset);
+  }
+
+  ~state_file() {
+    if (base_) {
+      ::msync(base_, size_, MS_ASYNC);
+      ::munmap(base_, size_);
+    }
+  }
+
+  state_file(const state_file&) = delete;
+  state_file& operator=(const state_file&) = delete;
+
+  // True if the file held a state to resume, else why not if there was a file
+  bool attached() const { return attached_; }
+  const std::string& reason() const { return reason_; }
+
+  std::size_t target_capacity() const { return header_->target_capacity; }
+  std::size_t group_capacity() const { return header_->group_capacity; }
+  std::uint64_t created() const { return header_->created; }
+
+  // Slots in use, the others hold nothing worth reading
+  std::size_t targets() const { return header_->targets; }
+  std::size_t groups() const { return header_->groups; }
+  void set_targets(std::size_t n) { header_->targets = n; }
+  void set_groups(std::size_t n) { header_->groups = n; }
+
+  state_target& target(std::size_t id) { return targets_[id]; }
+  const state_target& target(std::size_t id) const { return targets_[id]; }
+
+  void set_target(std::size_t id, const std::string& host, const std::string& address,
+      const std::string& labels) {
+    state_target& t = targets_[id];
+    std::memset(&t, 0, sizeof(t));
+    copy(t.host, sizeof(t.host), host);
+    copy(t.address, sizeof(t.address), address);
+    copy(t.labels, sizeof(t.labels), labels);
+    t.active = 1;
+  }
+
+  void set_labels(std::size_t id, const std::string& labels) {
+    state_target& t = targets_[id];
+    std::memset(t.labels, 0, sizeof(t.labels));
+    copy(t.labels, sizeof(t.labels), labels);
+  }
+
+  static std::string host(const state_target& t) { return std::string(t.host, strnlen(t.host, sizeof(t.host))); }
+  static std::string address(const state_target& t) {
+    return std::string(t.address, strnlen(t.address, sizeof(t.address)));
+  }
+  static std::string labels(const state_target& t) {
+    return std::string(t.labels, strnlen(t.labels, sizeof(t.labels)));
+  }
+
+  std::string group(std::size_t id) const {
+    const char* p = base_ + header_->groups_offset + id * group_bytes;
+    return std::string(p, strnlen(p, group_bytes));
+  }
+
+  void set_group(std::size_t id, const std::string& name) {
+    char* p = base_ + header_->groups_offset + id * group_bytes;
+    std::memset(p, 0, group_bytes);
+    copy(p, group_bytes, name);
+  }
+
+  // Memory of the stores, see stats_store(capacity, memory)
+  unsigned char* target_stats() { return reinterpret_cast<unsigned char*>(base_ + header_->target_stats_offset); }
+  unsigned char* group_stats() { return reinterpret_cast<unsigned char*>(base_ + header_->group_stats_offset); }
+
+private:
+  static std::uint64_t round_up(std::uint64_t n) { return (n + page - 1) / page * page; }
+
+  static header layout(std::size_t targets, std::size_t groups, std::uint64_t created) {
+    header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.target_size = sizeof(state_target);
+    h.histogram_size = sizeof(latency_histogram);
+    h.target_capacity = targets;
+    h.group_capacity = groups;
+    h.created = created;
+    h.targets_offset = page;
+    h.groups_offset = h.targets_offset + round_up(targets * sizeof(state_target));
+    h.target_stats_offset = h.groups_offset + round_up(groups * group_bytes);
+    h.group_stats_offset = h.target_stats_offset + round_up(stats_store::bytes(targets));
+    return h;
+  }
+
+  // The layout is entirely given by the capacities, so a file fits if its
+  // header is the one we would write for them
+  static bool fits(const header& h, std::uint64_t size, std::size_t targets, std::size_t groups) {
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version
+        || h.target_size != sizeof(state_target) || h.histogram_size != sizeof(latency_histogram)
+        || h.target_capacity < targets || h.group_capacity < groups
+        || h.targets > h.target_capacity || h.groups > h.group_capacity)
+      return false;
+    header expected = layout(h.target_capacity, h.group_capacity, h.created);
+    return h.targets_offset == expected.targets_offset && h.groups_offset == expected.groups_offset
+      && h.target_stats_offset == expected.target_stats_offset
+      && h.group_stats_offset == expected.group_stats_offset
+      && size >= h.group_stats_offset + stats_store::bytes(h.group_capacity);
+  }
+
+  static void copy(char* to, std::size_t bytes, const std::string& s) {
+    std::memcpy(to, s.data(), std::min(s.size(), bytes - 1));
+  }
+
+  static void fail(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+
+  std::string path_;
+  std::string reason_;
+  std::size_t size_;
+  char* base_;
+  header* header_;
+  state_target* targets_;
+  bool attached_;
+};
+
+}
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+
+#include "histogram.hpp"
+
+namespace nettool {
+
+// Counters and round trip time moments of a set of targets
+struct stats_summary {
+  std::uint64_t targets = 0;
+  std::uint64_t sent = 0;
+  std::uint64_t received = 0;
+  std::uint64_t lost = 0;
+  // Nanoseconds
+  std::uint64_t rtt_min = std::numeric_limits<std::uint64_t>::max();
+  std::uint64_t rtt_max = 0;
+  std::uint64_t rtt_sum = 0;
+  double rtt_mean = 0;
+  // Sum of squared deviations from the mean
+  double rtt_m2 = 0;
+
+  double rtt_mdev() const { return received ? std::sqrt(rtt_m2 / received) : 0; }
+
+  // Combine with the statistics of other targets or of the same target
+  // measured elsewhere. Counters and extremes are exact, the moments are
+  // merged as in Chan et al.
+  void merge(const stats_summary& o) {
+    std::uint64_t n = received + o.received;
+    if (n) {
+      double d = o.rtt_mean - rtt_mean;
+      rtt_m2 += o.rtt_m2 + d * d * received * o.received / n;
+      rtt_mean = static_cast<double>(rtt_sum + o.rtt_sum) / n;
+    }
+    targets += o.targets;
+    sent += o.sent;
+    received = n;
+    lost += o.lost;
+    rtt_min = std::min(rtt_min, o.rtt_min);
+    rtt_max = std::max(rtt_max, o.rtt_max);
+    rtt_sum += o.rtt_sum;
+  }
+};
+
+// Per-target statistics as a structure of arrays.
+//
+// Every field is a contiguous array indexed by the target id, carved from one
+// block of memory and aligned to a cache line, so a reply touches a few
+// scattered words and a roll-up over all targets is a linear pass per field.
+// Counters are 32 bits, times are integer nanoseconds. The mean and the sum
+// of squared deviations are updated with Welford's method, which does not
+// lose precision the way a sum of squares does.
+//
+// The 4 KB latency histogram of a target is most of its memory. A histogram
+// of zero bytes reads as empty, so one is only constructed on the first
+// reply of its target, and a slot without replies is never written: the
+// histograms of a store of its own are anonymous memory, pages the kernel
+// only provides once a target of theirs got a reply.
+class stats_store {
+public:
+  explicit stats_store(std::size_t capacity)
+      : capacity_(capacity), size_(0), mapped_(bytes(capacity)) {
+    void* p = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    memory_ = static_cast<unsigned char*>(p);
+    carve(memory_);
+    std::fill(rtt_min_, rtt_min_ + capacity_, std::numeric_limits<std::uint64_t>::max());
+  }
+
+  // A store over memory of the caller, bytes(capacity) aligned to a cache
+  // line, which keeps whatever it holds: a slot must be cleared before it
+  // is used for a new target
+  stats_store(std::size_t capacity, unsigned char* memory)
+      : capacity_(capacity), size_(0), mapped_(0), memory_(memory) {
+    carve(memory);
+  }
+
+  ~stats_store() {
+    if (mapped_) ::munmap(memory_, mapped_);
+  }
+
+  stats_store(const stats_store&) = delete;
+  stats_store& operator=(const stats_store&) = delete;
+
+  // Copy every field of a store of the same capacity, one memcpy of the block
+  void copy_from(const stats_store& other) {
+    if (other.capacity_ != capacity_) throw std::invalid_argument("stats_store capacity mismatch");
+    std::memcpy(memory_, other.memory_, bytes(capacity_));
+    size_ = other.size_;
+  }
+
+  static std::size_t bytes(std::size_t capacity) {
+    return 3 * align(capacity * sizeof(std::uint32_t))
+      + 3 * align(capacity * sizeof(std::uint64_t))
+      + 2 * align(capacity * sizeof(double))
+      + align(capacity * sizeof(latency_histogram)) + alignment;
+  }
+
+  std::size_t capacity() const { return capacity_; }
+  std::size_t size() const { return size_; }
+
+  // Take the next id, or return false if the store is full
+  bool add(std::size_t& id) {
+    if (size_ == capacity_) return false;
+    id = size_++;
+    return true;
+  }
+
+  // Forget everything about a slot
+  void clear(std::size_t id) {
+    if (received_[id]) histograms_[id].reset();
+    sent_[id] = received_[id] = lost_[id] = 0;
+    rtt_min_[id] = std::numeric_limits<std::uint64_t>::max();
+    rtt_max_[id] = rtt_sum_[id] = 0;
+    rtt_mean_[id] = rtt_m2_[id] = 0;
+  }
+
+  // Copy slot from_id of another store, or of this one, to slot id
+  void copy(std::size_t id, const stats_store& from, std::size_t from_id) {
+    // Histograms without replies are both empty
+    if (received_[id] || from.received_[from_id])
+      histograms_[id] = from.histograms_[from_id];
+    sent_[id] = from.sent_[from_id];
+    received_[id] = from.received_[from_id];
+    lost_[id] = from.lost_[from_id];
+    rtt_min_[id] = from.rtt_min_[from_id];
+    rtt_max_[id] = from.rtt_max_[from_id];
+    rtt_sum_[id] = from.rtt_sum_[from_id];
+    rtt_mean_[id] = from.rtt_mean_[from_id];
+    rtt_m2_[id] = from.rtt_m2_[from_id];
+  }
+
+  void on_sent(std::size_t id) { ++sent_[id]; }
+  void on_loss(std::size_t id) { ++lost_[id]; }
+
+  void on_reply(std::size_t id, std::uint64_t rtt) {
+    std::uint32_t n = ++received_[id];
+    if (n == 1) new (&histograms_[id]) latency_histogram();
+    rtt_min_[id] = std::min(rtt_min_[id], rtt);
+    rtt_max_[id] = std::max(rtt_max_[id], rtt);
+    rtt_sum_[id] += rtt;
+    double d = rtt - rtt_mean_[id];
+    rtt_mean_[id] += d / n;
+    rtt_m2_[id] += d * (rtt - rtt_mean_[id]);
+    histograms_[id].record(rtt);
+  }
+
+  std::uint32_t sent(std::size_t id) const { return sent_[id]; }
+  std::uint32_t received(std::size_t id) const { return received_[id]; }
+  std::uint32_t lost(std::size_t id) const { return lost_[id]; }
+  const latency_histogram& histogram(std::size_t id) const { return histograms_[id]; }
+
+  stats_summary at(std::size_t id) const { return rollup(id, id + 1); }
+
+  // Combine the targets [begin, end). The counters and extremes are plain
+  // reductions, the moments are merged as in Chan et al.:
+  //   mean = sum / n, M2 = sum M2_i + sum n_i (mean_i - mean)^2
+  stats_summary rollup(std::size_t begin, std::size_t end) const {
+    stats_summary s;
+    s.targets = end - begin;
+    std::uint64_t sent = 0, received = 0, lost = 0, sum = 0;
+    std::uint64_t lo = std::numeric_limits<std::uint64_t>::max(), hi = 0;
+#pragma omp simd reduction(+:sent, received, lost, sum) reduction(min:lo) reduction(max:hi)
+    for (std::size_t i = begin; i < end; ++i) {
+      sent += sent_[i];
+      received += received_[i];
+      lost += lost_[i];
+      sum += rtt_sum_[i];
+      lo = std::min(lo, rtt_min_[i]);
+      hi = std::max(hi, rtt_max_[i]);
+    }
+    s.sent = sent;
+    s.received = received;
+    s.lost = lost;
+    s.rtt_sum = sum;
+    s.rtt_min = lo;
+    s.rtt_max = hi;
+    if (received == 0) return s;
+
+    double mean = static_cast<double>(sum) / received;
+    double m2 = 0;
+#pragma omp simd reduction(+:m2)
+    for (std::size_t i = begin; i < end; ++i) {
+      double d = rtt_mean_[i] - mean;
+      m2 += rtt_m2_[i] + received_[i] * d * d;
+    }
+    s.rtt_mean = mean;
+    s.rtt_m2 = m2;
+    return s;
+  }
+
+  void merge_histograms(std::size_t begin, std::size_t end, latency_histogram& out) const {
+    for (std::size_t i = begin; i < end; ++i)
+      out.merge(histograms_[i]);
+  }
+
+private:
+  static constexpr std::size_t alignment = 64;
+
+  static std::size_t align(std::size_t n) { return (n + alignment - 1) / alignment * alignment; }
+
+  template<typename T>
+  T* take(unsigned char*& p) {
+    T* array = reinterpret_cast<T*>(p);
+    p += align(capacity_ * sizeof(T));
+    return array;
+  }
+
+  void carve(unsigned char* p) {
+    sent_ = take<std::uint32_t>(p);
+    received_ = take<std::uint32_t>(p);
+    lost_ = take<std::uint32_t>(p);
+    rtt_min_ = take<std::uint64_t>(p);
+    rtt_max_ = take<std::uint64_t>(p);
+    rtt_sum_ = take<std::uint64_t>(p);
+    rtt_mean_ = take<double>(p);
+    rtt_m2_ = take<double>(p);
+    histograms_ = take<latency_histogram>(p);
+  }
+
+  std::size_t capacity_;
+  std::size_t size_;
+  // Bytes mapped by the store itself, zero for memory of the caller
+  std::size_t mapped_;
+  unsigned char* memory_;
+
+  std::uint32_t* sent_;
+  std::uint32_t* received_;
+  std::uint32_t* lost_;
+  std::uint64_t* rtt_min_;
+  std::uint64_t* rtt_max_;
+  std::uint64_t* rtt_sum_;
+  double* rtt_mean_;
+  double* rtt_m2_;
+  latency_histogram* histograms_;
+};
+
+}
+
+#endif
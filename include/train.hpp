@@ -0,0 +1,132 @@
+#ifndef TRAIN_HPP
+#define TRAIN_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace nettool {
+
+// A train of back-to-back probes of the same size.
+//
+// The bottleneck link spaces the packets of the train by their transmission
+// time, so the dispersion of the replies estimates its capacity:
+//
+//   capacity = (received - 1) * wire bits of a packet / (last rx - first rx)
+//
+// Cross traffic widens the dispersion, the estimate is a lower bound of the
+// capacity. Losses within the train show how bursty the loss of the path is.
+class packet_train {
+public:
+  enum outcome : char { pending, received, lost };
+
+  void start(unsigned short first, std::size_t length, std::size_t wire_bytes) {
+    first_ = first;
+    wire_bytes_ = wire_bytes;
+    outcomes_.assign(length, pending);
+    outstanding_ = length;
+    received_ = 0;
+    first_rx_ = std::numeric_limits<std::int64_t>::max();
+    last_rx_ = std::numeric_limits<std::int64_t>::min();
+  }
+
+  bool active() const { return outstanding_ > 0; }
+
+  bool contains(unsigned short seq) const {
+    return static_cast<unsigned short>(seq - first_) < outcomes_.size();
+  }
+
+  // rx is the receive time in nanoseconds, the spacing of small packets on a
+  // fast link is well below a microsecond. Return true if the train is over
+  bool reply(unsigned short seq, std::int64_t rx) {
+    if (!resolve(seq, received)) return false;
+    ++received_;
+    first_rx_ = std::min(first_rx_, rx);
+    last_rx_ = std::max(last_rx_, rx);
+    return outstanding_ == 0;
+  }
+
+  bool loss(unsigned short seq) { return resolve(seq, lost) && outstanding_ == 0; }
+
+  std::size_t length() const { return outcomes_.size(); }
+  std::size_t received_count() const { return received_; }
+  std::size_t lost_count() const { return outcomes_.size() - received_ - outstanding_; }
+  std::int64_t dispersion() const { return received_ > 1 ? last_rx_ - first_rx_ : 0; }
+
+  // Bits per second, zero without two replies
+  double capacity() const {
+    return dispersion() > 0
+      ? (received_ - 1) * wire_bytes_ * 8 * 1e9 / dispersion() : 0;
+  }
+
+  // Runs of consecutive lost probes in sequence order
+  template<typename F>
+  void for_each_loss_run(F f) const {
+    std::size_t run = 0;
+    for (auto o : outcomes_) {
+      if (o == lost) {
+        ++run;
+      } else if (run) {
+        f(run);
+        run = 0;
+      }
+    }
+    if (run) f(run);
+  }
+
+private:
+  bool resolve(unsigned short seq, outcome o) {
+    if (!contains(seq)) return false;
+    char& slot = outcomes_[static_cast<unsigned short>(seq - first_)];
+    if (slot != pending) return false;
+    slot = o;
+    --outstanding_;
+    return true;
+  }
+
+  unsigned short first_ = 0;
+  std::size_t wire_bytes_ = 0;
+  std::vector<char> outcomes_;
+  std::size_t outstanding_ = 0;
+  std::size_t received_ = 0;
+  std::int64_t first_rx_ = 0;
+  std::int64_t last_rx_ = 0;
+};
+
+// Statistics over the trains of a target
+struct train_stats {
+  void record(const packet_train& train) {
+    ++trains;
+    lost += train.lost_count();
+    if (train.lost_count()) ++trains_with_loss;
+    train.for_each_loss_run([this](std::size_t run) {
+      ++loss_runs;
+      max_loss_run = std::max(max_loss_run, run);
+    });
+    double c = train.capacity();
+    if (c > 0) {
+      ++estimates;
+      capacity_sum += c;
+      capacity_min = std::min(capacity_min, c);
+      capacity_max = std::max(capacity_max, c);
+    }
+  }
+
+  double capacity_avg() const { return estimates ? capacity_sum / estimates : 0; }
+  double mean_loss_run() const { return loss_runs ? lost / static_cast<double>(loss_runs) : 0; }
+
+  std::size_t trains = 0;
+  std::size_t trains_with_loss = 0;
+  std::size_t lost = 0;
+  std::size_t loss_runs = 0;
+  std::size_t max_loss_run = 0;
+  std::size_t estimates = 0;
+  double capacity_sum = 0;
+  double capacity_min = std::numeric_limits<double>::max();
+  double capacity_max = 0;
+};
+
+}
+
+#endif
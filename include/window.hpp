@@ -0,0 +1,101 @@
+#ifndef WINDOW_HPP
+#define WINDOW_HPP
+
+#include <cstdint>
+
+#include "histogram.hpp"
+
+namespace nettool {
+
+// Round trip times of one slot of a sliding window: 528 buckets of at most
+// 6.3% relative width, 16 bit counters. Past 65535 values of one bucket in a
+// slot the percentiles only see those 65535, the received count sees all.
+using window_histogram = log_histogram<5, 36, std::uint16_t>;
+
+// Results of a sliding window
+struct window_summary {
+  std::uint64_t received = 0;
+  std::uint64_t lost = 0;
+  std::uint64_t p50 = 0;
+  std::uint64_t p99 = 0;
+  std::uint64_t max = 0;
+
+  double loss() const {
+    return received + lost ? 100.0 * lost / (received + lost) : 0;
+  }
+};
+
+// Latency and loss of a target over the last 1, 5 and 15 minutes.
+//
+// Time is cut into slots of slot_seconds on the realtime clock. A ring keeps
+// the current slot and the ones needed by the longest window, a sample only
+// touches the slot of its time, a slot is cleared when the ring comes back to
+// it. A window is the current slot plus the complete slots before it, so the
+// 1 minute window covers between 60 and 90 seconds.
+class sliding_windows {
+public:
+  enum { slot_seconds = 30, slot_count = 15 * 60 / slot_seconds + 1, window_count = 3 };
+
+  static constexpr int minutes[window_count] = {1, 5, 15};
+
+  // now is the time of the sample in seconds since the epoch
+  void on_reply(std::int64_t now, std::uint64_t rtt) {
+    slot& s = current(now);
+    ++s.received;
+    s.rtt.record(rtt);
+  }
+
+  void on_loss(std::int64_t now) { ++current(now).lost; }
+
+  // The 1, 5 and 15 minute windows in one pass: the slots are merged from
+  // the newest one back, a window is read off when its oldest slot is in
+  void summaries(std::int64_t now, window_summary (&w)[window_count]) const {
+    std::int64_t epoch = now / slot_seconds;
+    latency_histogram_type merged;
+    window_summary sum;
+    int next = 0;
+    for (std::int64_t e = epoch; next < window_count; --e) {
+      const slot* s = e >= 0 ? &slots_[e % slot_count] : nullptr;
+      if (s && s->epoch == e) {
+        sum.received += s->received;
+        sum.lost += s->lost;
+        merged.merge(s->rtt);
+      }
+      if (e == epoch - minutes[next] * 60 / slot_seconds) {
+        w[next] = sum;
+        w[next].p50 = merged.percentile(50);
+        w[next].p99 = merged.percentile(99);
+        w[next].max = merged.max();
+        ++next;
+      }
+    }
+  }
+
+private:
+  using latency_histogram_type = log_histogram<5, 36>;
+
+  struct slot {
+    std::int64_t epoch = -1;
+    std::uint32_t received = 0;
+    std::uint32_t lost = 0;
+    window_histogram rtt;
+  };
+
+  slot& current(std::int64_t now) {
+    std::int64_t epoch = now / slot_seconds;
+    slot& s = slots_[epoch % slot_count];
+    if (s.epoch != epoch) {
+      s.epoch = epoch;
+      s.received = 0;
+      s.lost = 0;
+      s.rtt.reset();
+    }
+    return s;
+  }
+
+  slot slots_[slot_count];
+};
+
+}
+
+#endif
@@ -1,13 +1,44 @@
+#include <atomic>
+#include <fstream>
 #include <iostream>
-#include <iomanip>
-#include <float.h>
+#include <limits>
+#include <memory>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <random>
+#include <sstream>
 #include <string>
-#include <boost/system.hpp>
+#include <unordered_map>
+#include <vector>
+#include <boost/system/error_code.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <algorithm>
 
+#include "export.hpp"
+#include "group.hpp"
+#include "changepoint.hpp"
+#include "control.hpp"
 #include "header.hpp"
+#include "histogram.hpp"
+#include "metrics.hpp"
+#include "output.hpp"
+#include "probelog.hpp"
+#include "rdns.hpp"
+#include "record.hpp"
+#include "stats.hpp"
+#include "owd.hpp"
+#include "rto.hpp"
+#include "schedule.hpp"
+#include "seqtrack.hpp"
+#include "series.hpp"
+#include "shm.hpp"
+#include "sink.hpp"
+#include "sla.hpp"
+#include "state.hpp"
+#include "train.hpp"
+#include "window.hpp"
 
 namespace asio = boost::asio;
 using boost::system::error_code;
@@ -18,201 +49,2115 @@ namespace posix_time = boost::posix_time;
 using asio::ip::icmp;
 using asio::deadline_timer;
 
+struct options {
+  std::vector<std::string> hosts;
+  posix_time::time_duration interval = posix_time::seconds(1);
+  posix_time::time_duration rto_min = posix_time::milliseconds(200);
+  posix_time::time_duration rto_max = posix_time::seconds(5);
+  // Without a schedule the next probe waits for the reply or the timeout
+  bool open_loop = false;
+  probe_schedule::kind schedule = probe_schedule::fixed;
+  double jitter = 0.5;
+  std::uint64_t seed = std::random_device{}();
+  // Number of probes a target may have in flight, a power of two, zero
+  // to derive it from the interval and the timeout
+  std::size_t window = 0;
+  // Start on a multiple of this period of the realtime clock, zero if not
+  posix_time::time_duration align = posix_time::seconds(0);
+  // Send timestamp requests instead of echo requests
+  bool timestamp = false;
+  // Probes per round, back to back, and bytes of echo data
+  std::size_t burst = 1;
+  std::size_t size = 56;
+  // Keep 1, 5 and 15 minute sliding windows
+  bool windows = false;
+  // Write the statistics to this file at the end, empty if not
+  std::string export_file;
+  // Combine the statistics files given instead of hosts
+  bool merge = false;
+  // Memory budget of the probe time series in bytes, zero if not kept, and
+  // the file to write them to at the end
+  std::size_t series = 0;
+  std::string series_file;
+  // Alert rules
+  std::vector<sla_rule> rules;
+  // Also group the targets by subnet of this prefix length, zero if not
+  int subnet = 0;
+  // Records on standard output instead of text, which goes to standard error
+  record_format format = record_format::text;
+  // Report level shifts of the round trip time
+  bool changes = false;
+  // Binary record of every probe, ring size in bytes
+  std::string log_file;
+  std::size_t log_size = 64 << 20;
+  bool read_log = false;
+  // OpenMetrics endpoint, port 0 for none
+  std::string metrics_address = "0.0.0.0";
+  unsigned short metrics_port = 0;
+  // Shared memory segment of live statistics, and whether it outlives us
+  std::string shm_name;
+  bool shm_keep = false;
+  // Daemon: control socket, and the targets it may add over its lifetime
+  std::string control;
+  std::size_t max_targets = 1024;
+  // Statistics and adaptive state kept across restarts
+  std::string state_file;
+  // A line per target and group every interval instead of a line per
+  // probe, zero if not; only the groups and the total if summary_groups
+  posix_time::time_duration summary = posix_time::seconds(0);
+  bool summary_groups = false;
+  // Shared library the results are handed to in batches, and its config
+  std::string sink;
+  std::string sink_config;
+  // Reverse lookup of the reply sources: entries and seconds they are kept
+  bool names = false;
+  std::size_t names_size = 4096;
+  std::int64_t names_ttl = 300;
+};
+
+// Counters, moments and percentiles of one target or of a set of them
+template<typename Out>
+void print_statistics(Out& out, const stats_summary& s, const latency_histogram& h,
+    double total_time) {
+  out.print(FMT_COMPILE("{} packets transmitted, {} received, {} lossed, {:.2f}% loss, time {:.3f} s\n"),
+      s.sent, s.received, s.sent - s.received,
+      s.sent ? 100.0 * (s.sent - s.received) / s.sent : 0.0, total_time);
+  // Without a reply there is no round trip time to speak of
+  if (s.received == 0) return;
+  out.print(FMT_COMPILE("rtt min/avg/max/mdev {:.3f}/{:.3f}/{:.3f}/{:.3f} ms\n"
+        "rtt p50/p90/p99/p99.9/max {:.3f}/{:.3f}/{:.3f}/{:.3f}/{:.3f} ms\n"),
+      s.rtt_min / 1e6, s.rtt_mean / 1e6, s.rtt_max / 1e6, s.rtt_mdev() / 1e6,
+      h.percentile(50) / 1e6, h.percentile(90) / 1e6, h.percentile(99) / 1e6,
+      h.percentile(99.9) / 1e6, h.max() / 1e6);
+}
+
+// A probe waiting for its reply
+struct probe {
+  unsigned short sequence_number = 0;
+  bool pending = false;
+  std::size_t num_replies = 0;
+  posix_time::ptime time_sent;
+  // Replies arriving after the deadline are counted as lost
+  posix_time::ptime deadline;
+  // Round trip time in nanoseconds once replied, negative before
+  std::int64_t rtt = -1;
+};
 
-// 1. Resolve destination address with DNS resolver
-// 2. Construct and send ICMP message
-//    -> wait for timeout or signal for a valid return message
-//    -> sent the next message
+// State of a single destination. Every target owns its timers, sequence
+// number and timeout estimator. A reply is matched by the identifier and
+// the target id which its probe carried, not by its source, so a target
+// may answer from another address.
+struct target {
+  target(asio::io_service& io_service, const std::string& host,
+      const icmp::endpoint& destination, const options& opts, std::size_t id)
+      : host(host), destination(destination),
+      send_timer(io_service), timeout_timer(io_service),
+      sequence_number(0), oldest(1),
+      window(initial_window(opts)), timeout_armed(false),
+      rto(opts.rto_min.total_microseconds(), opts.rto_max.total_microseconds()),
+      schedule(opts.schedule, opts.interval.total_microseconds(), opts.jitter, opts.seed + id),
+      windows(opts.windows ? new sliding_windows : nullptr) {}
+
+  probe& slot(unsigned short seq) { return window[seq & (window.size() - 1)]; }
+
+  // A round and its predecessor's last probe, the window grows from there
+  static std::size_t initial_window(const options& opts) {
+    std::size_t size = 2;
+    while (size < opts.burst * 2 && size < opts.window)
+      size <<= 1;
+    return std::min(size, opts.window);
+  }
+
+  // Double the window, a probe keeps the slot of its sequence number. The
+  // probes of the smaller window have distinct slots in the larger one.
+  void grow() {
+    std::vector<probe> larger(window.size() * 2);
+    for (const probe& p : window) {
+      if (!p.time_sent.is_not_a_date_time())
+        larger[p.sequence_number & (larger.size() - 1)] = p;
+    }
+    window.swap(larger);
+  }
+
+  std::string host;
+  icmp::endpoint destination;
+  deadline_timer send_timer;
+  deadline_timer timeout_timer;
+  // Last sequence number sent, and the oldest one which may be in flight
+  unsigned short sequence_number;
+  unsigned short oldest;
+  // Up to options::window probes, allocated as they are needed
+  std::vector<probe> window;
+  bool timeout_armed;
+  rto_estimator rto;
+
+  probe_schedule schedule;
+  gap_stats gaps;
+  owd_tracker owd;
+  // Scheduled time of the next round, on the realtime clock
+  posix_time::ptime next_send;
+  posix_time::ptime round_sent;
+  packet_train train;
+  train_stats trains;
+  std::unique_ptr<sliding_windows> windows;
+  sequence_tracker sequence;
+  ipdv_stats ipdv;
+  change_detector level;
+  // Round trip time of the last reply, ns
+  std::uint64_t last_rtt = 0;
+  // Ids of the groups of the target in groups_
+  std::vector<std::size_t> groups;
+  // False once removed through the control socket
+  bool active = true;
+};
+
+// Destination address -> target id. A published table is never changed, an
+// update copies it and swaps the pointer, see pinger::publish_table().
+struct target_table {
+  std::unordered_map<asio::ip::address_v4::uint_type, std::size_t> index;
+};
+
+
+// 1. Resolve destination addresses with DNS resolver
+// 2. Construct and send ICMP message to each target
+//    -> wait for the adaptive timeout or a valid return message
+//    -> sent the next message after the probe interval
 // 3. Prepare buffer -> handle received messages -> receive next
 class pinger {
 public:
-  pinger(asio::io_service& io_service, const char* destination)
-      : resolver_(io_service),
+  pinger(asio::io_service& io_service, const options& opts)
+      : opts_(opts),
+      io_service_(io_service),
+      resolver_(io_service),
       socket_(io_service, icmp::v4()),
-      timer_(io_service),
-      sequence_number_(0),
-      num_replies_(0),
+      body_(opts.size, 'z'),
+      state_(opts.state_file.empty() ? nullptr : new state_file(opts.state_file,
+            capacity(opts), capacity(opts), ns(posix_time::microsec_clock::universal_time()))),
+      stats_(state_ ? stats_store(state_->target_capacity(), state_->target_stats())
+          : stats_store(capacity(opts))),
+      series_(opts.series ? new series_store(opts.series) : nullptr),
+      rules_(opts.rules),
       signals_(io_service, SIGINT),
       time_init_(posix_time::microsec_clock::universal_time()),
-      num_transmitted_(0), num_received_(0),
-      ttl_min_(LDBL_MAX), ttl_max_(0),
-      ttl_sum_(0), ttl_sum2_(0)
+      snapshot_signals_(io_service, SIGQUIT, SIGUSR1),
+      out_(opts.format == record_format::text ? STDOUT_FILENO : STDERR_FILENO),
+      flush_timer_(io_service),
+      summary_timer_(io_service),
+      records_(opts.format == record_format::text ? nullptr
+          : new record_writer(opts.format, STDOUT_FILENO, record_buffer))
   {
     signals_.async_wait(boost::bind(&pinger::handle_termination,
           this, asio::placeholders::error, asio::placeholders::signal_number));
-    // basic_resolver: protocol, services, flags
-    icmp::resolver::query query(icmp::v4(), destination, "");
-    // a iterator of queried endpoint is returned
-    destination_ = *resolver_.resolve(query);
+    snapshot_signals_.async_wait(boost::bind(&pinger::handle_snapshot,
+          this, asio::placeholders::error, asio::placeholders::signal_number));
 
-    start_send();
+    if (!opts.control.empty())
+      signals_.add(SIGTERM);
+    if (!id_in_data() && stats_.capacity() > 65536)
+      throw std::invalid_argument("without 4 bytes of echo data the target is in the 16 bit identifier, "
+          "at most 65536 targets");
+    if (state_ && !state_->reason().empty())
+      std::cerr << state_->reason() << std::endl;
+
+    // Targets are never moved, a daemon may add up to the capacity
+    targets_.reserve(stats_.capacity());
+    std::unique_ptr<target_table> table(new target_table);
+    for (const auto& arg : opts.hosts) {
+      std::string error;
+      if (!add_target(arg, *table, error) && stats_.size() == stats_.capacity()) break;
+    }
+    // Slot in the state file of every target, none for a new one
+    std::vector<std::size_t> saved;
+    if (state_)
+      saved = find_saved(*table);
+
+    // A group a rule is scoped to may not have members yet in a daemon
+    rule_groups_.assign(rules_.rules().size(), sla_engine::scope_target);
+    for (std::size_t i = 0; i < rules_.rules().size(); ++i) {
+      const std::string& scope = rules_.rules()[i].scope;
+      if (scope.empty() || scope == "all") continue;
+      if (opts.control.empty() && !group_names_.find(scope, rule_groups_[i]))
+        throw std::invalid_argument("no group " + scope + " for rule " + rules_.rules()[i].text);
+      rule_groups_[i] = group_names_.add(scope);
+    }
+    // Groups are rolled up as the events arrive, in a store of their own
+    state_groups_ = state_ && group_names_.size() <= state_->group_capacity();
+    if (state_groups_) {
+      groups_.reset(new stats_store(state_->group_capacity(), state_->group_stats()));
+    } else {
+      if (state_)
+        std::cerr << "too many groups for the state file, they start afresh" << std::endl;
+      groups_.reset(new stats_store(std::max(group_names_.size(),
+              opts.control.empty() && !state_ ? 0 : opts.max_targets)));
+    }
+    for (std::size_t g = 0, id; g < group_names_.size(); ++g)
+      groups_->add(id);
+    if (state_)
+      restore(saved);
+    if (summary()) {
+      interval_.reset(new stats_store(stats_.capacity()));
+      interval_groups_.reset(new stats_store(groups_->capacity()));
+    }
+
+    rules_.resize(stats_.capacity());
+    for (std::size_t i = 0; i < rule_groups_.size(); ++i) {
+      if (rule_groups_[i] != sla_engine::scope_target)
+        rules_.restrict(i, std::vector<bool>(stats_.capacity()));
+    }
+    for (std::size_t id = 0; id < targets_.size(); ++id)
+      update_rule_members(id);
+
+    if (!opts.log_file.empty()) {
+      log_.reset(new probe_log(opts.log_file, opts.log_size, stats_.capacity(), ns(time_init_)));
+      for (std::size_t id = 0; id < targets_.size(); ++id)
+        log_->set_name(id, targets_[id].host, targets_[id].destination.address().to_string());
+    }
+    if (opts.names)
+      names_.reset(new name_cache(io_service, opts.names_size, opts.names_ttl));
+    if (!opts.sink.empty()) {
+      sink_.reset(new result_sink(opts.sink, opts.sink_config, stats_.capacity()));
+      for (std::size_t id = 0; id < targets_.size(); ++id)
+        sink_->set_target(id, targets_[id].host, targets_[id].destination.address().to_string());
+    }
+    if (!opts.shm_name.empty()) {
+      shm_.reset(new shm_stats(opts.shm_name, stats_.capacity(), ns(time_init_), opts.shm_keep));
+      for (std::size_t id = 0; id < targets_.size(); ++id) {
+        if (targets_[id].active)
+          shm_->set_name(id, targets_[id].host, targets_[id].destination.address().to_string());
+        publish(id, time_init_);
+      }
+    }
+    if (opts.metrics_port) {
+      for (const auto& t : targets_)
+        metric_labels_.push_back(t.active ? metric_label(t) : std::string());
+      metrics_.reset(new metrics_server(io_service,
+            asio::ip::tcp::endpoint(asio::ip::make_address(opts.metrics_address), opts.metrics_port),
+            stats_, metric_labels_, *groups_, group_names_.names(),
+            opts.windows ? metrics_server::window_source(
+              [this](std::size_t id, window_summary (&w)[sliding_windows::window_count]) {
+                const target& t = targets_[id];
+                if (!t.windows) return false;
+                t.windows->summaries((posix_time::microsec_clock::universal_time() - epoch()).total_seconds(), w);
+                return true;
+              }) : metrics_server::window_source()));
+    }
+    publish_table(std::move(table));
+    if (!opts.control.empty()) {
+      control_.reset(new control_server(io_service, opts.control,
+            [this](const std::string& command, control_reply& reply) {
+              handle_command(command, reply);
+            }));
+    }
+
+    // A broadcast address is a target like any other
+    socket_.set_option(asio::socket_base::broadcast(true));
+    // Let the kernel stamp every datagram with its receive time
+    int on = 1;
+    if (::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+      std::cerr << "SO_TIMESTAMPNS: " << strerror(errno) << std::endl;
     start_receive();
   }
+
+  // Send the first round. With alignment every process started with the same
+  // period begins on the same boundary of the realtime clock, the following
+  // rounds stay on the grid of the interval.
+  void start() {
+    auto start = posix_time::microsec_clock::universal_time();
+    if (!opts_.align.is_special() && opts_.align.total_microseconds() > 0) {
+      long period = opts_.align.total_microseconds();
+      long since_epoch = (start - epoch()).total_microseconds();
+      start = epoch() + posix_time::microseconds((since_epoch / period + 1) * period);
+    }
+    for (std::size_t i = 0; i < targets_.size(); ++i) {
+      targets_[i].next_send = start;
+      arm_send(i, start);
+    }
+    started_ = true;
+    arm_flush();
+    if (summary()) {
+      summary_start_ = start;
+      summary_timer_.expires_at(start + opts_.summary);
+      summary_timer_.async_wait(boost::bind(&pinger::handle_summary, this, asio::placeholders::error));
+    }
+  }
+
+  ~pinger() {
+    delete table_.load();
+  }
+
 private:
+  // A daemon, or a state file, keeps room for targets added later
+  static std::size_t capacity(const options& opts) {
+    return opts.control.empty() && opts.state_file.empty() ? opts.hosts.size()
+      : std::max(opts.hosts.size(), opts.max_targets);
+  }
+
+  // Resolve and add a target, "host[@label,...]", or take the address
+  // given. Return false with the reason if it is not added, nothing has
+  // changed then. The new target goes into table, which is published by
+  // the caller.
+  bool add_target(const std::string& arg, target_table& table, std::string& error,
+      const std::string& address_of_host = std::string()) {
+    labeled_host labeled = labeled_host::parse(arg);
+    // An address needs no resolver, which matters for many targets
+    error_code ec;
+    auto literal = asio::ip::make_address_v4(
+        address_of_host.empty() ? labeled.host : address_of_host, ec);
+    icmp::endpoint destination;
+    if (!ec) {
+      destination = icmp::endpoint(literal, 0);
+    } else {
+      // basic_resolver: protocol, services, flags
+      icmp::resolver::query query(icmp::v4(), labeled.host, "");
+      // a iterator of queried endpoint is returned
+      destination = *resolver_.resolve(query);
+    }
+    auto addr = destination.address().to_v4().to_uint();
+    if (table.index.count(addr)) {
+      error = "duplicate destination " + destination.address().to_string();
+      return false;
+    }
+    if (opts_.subnet)
+      labeled.groups.push_back(subnet_name(addr, opts_.subnet));
+    if (!groups_fit(labeled.groups, error))
+      return false;
+    std::size_t id = 0;
+    if (!stats_.add(id)) {
+      error = "no room for more targets";
+      return false;
+    }
+    if (series_) series_->add();
+    table.index[addr] = id;
+    targets_.emplace_back(io_service_, labeled.host, destination, opts_, id);
+    target& t = targets_.back();
+    set_groups(id, labeled.groups);
+
+    // Only for a target added at runtime, the tables are filled at once
+    // when they are created
+    std::string address = destination.address().to_string();
+    if (log_)
+      log_->set_name(id, t.host, address);
+    if (sink_)
+      sink_->set_target(id, t.host, address);
+    if (shm_) {
+      shm_->set_name(id, t.host, address);
+      publish(id, posix_time::microsec_clock::universal_time());
+    }
+    if (metrics_)
+      metric_labels_.push_back(metric_label(t));
+    // The slot may hold a target of an earlier run
+    if (restored_) {
+      stats_.clear(id);
+      state_->set_target(id, t.host, address, labels(t));
+      state_->set_targets(id + 1);
+    }
+    if (started_) {
+      t.next_send = posix_time::microsec_clock::universal_time();
+      arm_send(id, t.next_send);
+    }
+    return true;
+  }
+
+  // Stop probing a target. Its statistics stay for the summary, its id is
+  // not used again.
+  void remove_target(std::size_t id) {
+    target& t = targets_[id];
+    std::unique_ptr<target_table> next(new target_table(table()));
+    next->index.erase(t.destination.address().to_v4().to_uint());
+    publish_table(std::move(next));
+    t.active = false;
+    error_code ignored;
+    t.send_timer.cancel(ignored);
+    t.timeout_timer.cancel(ignored);
+    set_groups(id, {});
+    if (state_)
+      state_->target(id).active = 0;
+    if (metrics_)
+      metric_labels_[id].clear();
+    if (shm_)
+      shm_->set_name(id, "", "");
+  }
+
+  // Return false if the new groups among names would not fit the store
+  bool groups_fit(const std::vector<std::string>& names, std::string& error) const {
+    if (!groups_) return true;
+    std::vector<std::string> added;
+    for (const auto& name : names) {
+      std::size_t g;
+      if (!group_names_.find(name, g) && std::find(added.begin(), added.end(), name) == added.end())
+        added.push_back(name);
+    }
+    if (groups_->size() + added.size() <= groups_->capacity()) return true;
+    error = "no room for more groups";
+    return false;
+  }
+
+  // Move a target to other groups. Events from now on count in the new
+  // groups, the old ones keep what the target contributed so far.
+  void set_groups(std::size_t id, const std::vector<std::string>& names) {
+    target& t = targets_[id];
+    for (std::size_t g : t.groups)
+      group_names_.remove_member(g);
+    t.groups.clear();
+    for (const auto& name : names) {
+      std::size_t g = group_names_.add_member(name);
+      if (std::find(t.groups.begin(), t.groups.end(), g) != t.groups.end()) {
+        group_names_.remove_member(g);
+        continue;
+      }
+      t.groups.push_back(g);
+      std::size_t unused;
+      if (groups_ && g == groups_->size()) {
+        groups_->add(unused);
+        if (restored_ && state_groups_) {
+          groups_->clear(g);
+          state_->set_group(g, name);
+          state_->set_groups(g + 1);
+        }
+      }
+    }
+    if (restored_)
+      state_->set_labels(id, labels(t));
+    update_rule_members(id);
+  }
+
+  // Groups of a target as labels, every group named in full so that
+  // parsing them gives the same groups
+  std::string labels(const target& t) const {
+    std::string s;
+    for (std::size_t g : t.groups)
+      s += (s.empty() ? "" : ",") + group_names_.name(g);
+    return s;
+  }
+
+  // Slot in the state file of every target, matched by host and address,
+  // or npos for a target the file does not know. A daemon also takes back
+  // the targets it had added, and removed, at their next ids.
+  std::vector<std::size_t> find_saved(target_table& table) {
+    const std::size_t none = std::string::npos;
+    // By address, the host name is compared on a match
+    std::unordered_map<asio::ip::address_v4::uint_type, std::size_t> slots;
+    slots.reserve(state_->targets());
+    for (std::size_t i = 0; i < state_->targets(); ++i) {
+      const state_target& s = state_->target(i);
+      error_code ec;
+      auto addr = asio::ip::make_address_v4(state_file::address(s), ec).to_uint();
+      if (ec) continue;
+      auto it = slots.find(addr);
+      // An active target wins over one of the same address removed earlier
+      if (it == slots.end() || s.active)
+        slots[addr] = i;
+    }
+    std::vector<std::size_t> saved(targets_.size(), none);
+    std::vector<bool> taken(state_->targets());
+    for (std::size_t id = 0; id < targets_.size(); ++id) {
+      const target& t = targets_[id];
+      auto it = slots.find(t.destination.address().to_v4().to_uint());
+      if (it == slots.end() || taken[it->second]
+          || state_file::host(state_->target(it->second)) != t.host.substr(0, sizeof(state_target::host) - 1))
+        continue;
+      saved[id] = it->second;
+      taken[it->second] = true;
+    }
+    if (opts_.control.empty()) return saved;
+
+    for (std::size_t i = 0; i < state_->targets(); ++i) {
+      if (taken[i]) continue;
+      const state_target& s = state_->target(i);
+      std::string text = state_file::labels(s), error;
+      std::string arg = state_file::host(s) + (text.empty() ? "" : "@" + text);
+      if (!add_target(arg, table, error, state_file::address(s))) continue;
+      saved.push_back(i);
+      if (s.active) continue;
+      std::size_t id = targets_.size() - 1;
+      table.index.erase(targets_[id].destination.address().to_v4().to_uint());
+      targets_[id].active = false;
+      set_groups(id, {});
+    }
+    return saved;
+  }
+
+  // Move the saved statistics and state to the ids of this run, clear the
+  // slots of new targets and groups, and take back the timeout estimators
+  // and sequence numbers.
+  void restore(const std::vector<std::size_t>& saved) {
+    const std::size_t none = std::string::npos;
+    std::unordered_map<std::string, std::size_t> group_slots;
+    for (std::size_t g = 0; state_groups_ && g < state_->groups(); ++g)
+      group_slots[state_->group(g)] = g;
+    std::vector<std::size_t> saved_groups(group_names_.size(), none);
+    for (std::size_t g = 0; g < group_names_.size(); ++g) {
+      auto it = group_slots.find(group_names_.name(g));
+      if (it != group_slots.end()) saved_groups[g] = it->second;
+    }
+
+    // A slot may be wanted by one id and overwritten by another, so the
+    // moving ones are copied aside first
+    std::vector<std::size_t> moved;
+    for (std::size_t id = 0; id < saved.size(); ++id) {
+      if (saved[id] != none && saved[id] != id) moved.push_back(id);
+    }
+    stats_store aside(moved.size());
+    std::vector<state_target> aside_targets(moved.size());
+    for (std::size_t k = 0; k < moved.size(); ++k) {
+      aside.copy(k, stats_, saved[moved[k]]);
+      aside_targets[k] = state_->target(saved[moved[k]]);
+    }
+    for (std::size_t k = 0; k < moved.size(); ++k) {
+      stats_.copy(moved[k], aside, k);
+      state_->target(moved[k]) = aside_targets[k];
+    }
+    for (std::size_t id = 0; id < saved.size(); ++id) {
+      target& t = targets_[id];
+      state_target& s = state_->target(id);
+      if (saved[id] == none) {
+        stats_.clear(id);
+        state_->set_target(id, t.host, t.destination.address().to_string(), labels(t));
+        continue;
+      }
+      t.rto.restore(s.srtt, s.rttvar, s.rto);
+      t.last_rtt = s.last_rtt;
+      t.sequence_number = s.sequence;
+      t.oldest = s.sequence + 1;
+      state_->set_labels(id, labels(t));
+    }
+    state_->set_targets(saved.size());
+
+    if (state_groups_) {
+      moved.clear();
+      for (std::size_t g = 0; g < saved_groups.size(); ++g) {
+        if (saved_groups[g] != none && saved_groups[g] != g) moved.push_back(g);
+      }
+      stats_store aside_groups(moved.size());
+      for (std::size_t k = 0; k < moved.size(); ++k)
+        aside_groups.copy(k, *groups_, saved_groups[moved[k]]);
+      for (std::size_t k = 0; k < moved.size(); ++k)
+        groups_->copy(moved[k], aside_groups, k);
+      for (std::size_t g = 0; g < saved_groups.size(); ++g) {
+        if (saved_groups[g] == none) groups_->clear(g);
+        state_->set_group(g, group_names_.name(g));
+      }
+      state_->set_groups(saved_groups.size());
+    }
+    restored_ = true;
+  }
+
+  // Keep the adaptive state of a target in the state file
+  void save(std::size_t id) {
+    const target& t = targets_[id];
+    state_target& s = state_->target(id);
+    s.srtt = t.rto.srtt();
+    s.rttvar = t.rto.rttvar();
+    s.rto = t.rto.rto();
+    s.last_rtt = t.last_rtt;
+    s.sequence = t.sequence_number;
+  }
+
+  void update_rule_members(std::size_t id) {
+    if (rule_groups_.empty()) return;
+    const target& t = targets_[id];
+    for (std::size_t i = 0; i < rule_groups_.size(); ++i) {
+      if (rule_groups_[i] == sla_engine::scope_target) continue;
+      rules_.set_member(i, id, t.active
+          && std::find(t.groups.begin(), t.groups.end(), rule_groups_[i]) != t.groups.end());
+    }
+  }
+
+  static std::string metric_label(const target& t) {
+    return "target=" + metrics_server::label_value(t.host)
+      + ",address=\"" + t.destination.address().to_string() + "\"";
+  }
+
+  const target_table& table() const { return *table_.load(std::memory_order_acquire); }
+
+  // Swap in a new table. Every reader runs on the io_service, so once the
+  // handler which swapped returns nobody can hold the old table any more:
+  // a handler posted behind it frees it.
+  void publish_table(std::unique_ptr<target_table> next) {
+    const target_table* old = table_.exchange(next.release(), std::memory_order_acq_rel);
+    if (old)
+      asio::post(io_service_, [old] { delete old; });
+  }
+
+  // Active target named host or with this address
+  bool find_target(const std::string& name, std::size_t& id) const {
+    for (id = 0; id < targets_.size(); ++id) {
+      const target& t = targets_[id];
+      if (t.active && (t.host == name || t.destination.address().to_string() == name))
+        return true;
+    }
+    return false;
+  }
+
+  // Commands of the control socket:
+  //   add <host>[@label,...]...   start probing
+  //   remove <host>...            stop probing, the statistics stay
+  // add and remove answer for each host, one failing leaves the others done
+  //   tag <host> [label,...]      replace the groups of a target
+  //   list                        targets with their groups
+  //   stats [<host>]              statistics of every target, or of one
+  //   series <host> [<seconds>]   kept probe results, of the last seconds
+  void handle_command(const std::string& line, control_reply& reply) {
+    std::istringstream is(line);
+    std::string command, arg;
+    is >> command;
+    std::size_t id;
+    if (command == "add") {
+      while (is >> arg) {
+        std::unique_ptr<target_table> next(new target_table(table()));
+        std::string error;
+        bool added;
+        try {
+          added = add_target(arg, *next, error);
+        } catch (const std::exception& e) {
+          // The resolver throws
+          added = false;
+          error = e.what();
+        }
+        if (!added) {
+          reply.print(FMT_COMPILE("failed {}: {}\n"), arg, error);
+          continue;
+        }
+        publish_table(std::move(next));
+        const target& t = targets_.back();
+        reply.print(FMT_COMPILE("added {} {} id {}\n"), t.host,
+            t.destination.address().to_string(), targets_.size() - 1);
+      }
+    } else if (command == "remove") {
+      while (is >> arg) {
+        if (!find_target(arg, id)) {
+          reply.print(FMT_COMPILE("failed {}: no target\n"), arg);
+          continue;
+        }
+        remove_target(id);
+        reply.print(FMT_COMPILE("removed {}\n"), arg);
+      }
+    } else if (command == "tag") {
+      std::string labels;
+      if (!(is >> arg) || !find_target(arg, id))
+        return reply.error("no target " + arg);
+      is >> labels;
+      labeled_host labeled = labeled_host::parse("@" + labels);
+      if (opts_.subnet)
+        labeled.groups.push_back(subnet_name(targets_[id].destination.address().to_v4().to_uint(), opts_.subnet));
+      std::string error;
+      if (!groups_fit(labeled.groups, error))
+        return reply.error(error);
+      set_groups(id, labeled.groups);
+    } else if (command == "list") {
+      for (std::size_t id = 0; id < targets_.size(); ++id) {
+        const target& t = targets_[id];
+        if (!t.active) continue;
+        reply.print(FMT_COMPILE("{} {} {}"), id, t.host, t.destination.address().to_string());
+        for (std::size_t i = 0; i < t.groups.size(); ++i)
+          reply.print(FMT_COMPILE("{}{}"), i ? "," : " ", group_names_.name(t.groups[i]));
+        reply.print(FMT_COMPILE("\n"));
+      }
+    } else if (command == "stats") {
+      double total_time = (posix_time::microsec_clock::universal_time() - time_init_).total_milliseconds() / 1000.0;
+      if (is >> arg) {
+        if (!find_target(arg, id))
+          return reply.error("no target " + arg);
+        const target& t = targets_[id];
+        print_statistics(reply, stats_.at(id), stats_.histogram(id), total_time);
+        reply.print(FMT_COMPILE("rto srtt/rttvar/rto {:.3f}/{:.3f}/{:.3f} ms\n"),
+            t.rto.srtt() / 1000.0, t.rto.rttvar() / 1000.0, t.rto.rto() / 1000.0);
+        return;
+      }
+      auto line = [&](const std::string& name, const stats_summary& s, const latency_histogram& h) {
+        reply.print(FMT_COMPILE("{}: {} sent, {} received, {} lost, {:.2f}% loss, "
+              "rtt avg/p50/p99 {:.3f}/{:.3f}/{:.3f} ms\n"),
+            name, s.sent, s.received, s.lost,
+            s.sent ? 100.0 * (s.sent - std::min(s.sent, s.received)) / s.sent : 0.0,
+            s.rtt_mean / 1e6, h.percentile(50) / 1e6, h.percentile(99) / 1e6);
+      };
+      for (std::size_t id = 0; id < targets_.size(); ++id) {
+        if (targets_[id].active)
+          line(targets_[id].host, stats_.at(id), stats_.histogram(id));
+      }
+      latency_histogram all;
+      stats_.merge_histograms(0, targets_.size(), all);
+      line("total", stats_.rollup(0, targets_.size()), all);
+      for (std::size_t g = 0; g < group_names_.size(); ++g)
+        line("group " + group_names_.name(g), groups_->at(g), groups_->histogram(g));
+    } else if (command == "series") {
+      if (!series_)
+        return reply.error("no series kept, see --series");
+      if (!(is >> arg) || !find_target(arg, id))
+        return reply.error("no target " + arg);
+      double last = 0;
+      is >> last;
+      std::int64_t now = (posix_time::microsec_clock::universal_time() - epoch()).total_microseconds();
+      fmt::memory_buffer b;
+      series_->query(id, last > 0 ? now - static_cast<std::int64_t>(last * 1e6) : 0,
+          std::numeric_limits<std::int64_t>::max(),
+          [&](std::int64_t time, std::int64_t rtt) { series_sample(b, time, rtt); });
+      reply.print(FMT_COMPILE("{}"), fmt::string_view(b.data(), b.size()));
+    } else {
+      reply.error("unknown command " + command);
+    }
+  }
+
+  static posix_time::ptime epoch() {
+    return posix_time::ptime(boost::gregorian::date(1970, 1, 1));
+  }
+
+  static double seconds(const posix_time::ptime& t) {
+    return (t - epoch()).total_microseconds() / 1e6;
+  }
+
+  static std::uint64_t ns(const posix_time::ptime& t) {
+    return (t - epoch()).total_microseconds() * 1000;
+  }
+
+  static std::int64_t us_since_midnight(const posix_time::ptime& t) {
+    return t.time_of_day().total_microseconds();
+  }
+
+  void sink_result(std::size_t id, const posix_time::ptime& sent, std::uint64_t rtt,
+      std::uint16_t seq, std::uint8_t outcome, std::uint8_t ttl, std::uint16_t bytes) {
+    nettool_result r;
+    r.sent = ns(sent);
+    r.rtt = rtt;
+    r.target = id;
+    r.address = targets_[id].destination.address().to_v4().to_uint();
+    r.sequence = seq;
+    r.outcome = outcome;
+    r.ttl = ttl;
+    r.bytes = bytes;
+    r.reserved = 0;
+    sink_->append(r);
+  }
+
+  // Copy the statistics of a target to the shared memory segment
+  void publish(std::size_t id, const posix_time::ptime& now) {
+    const target& t = targets_[id];
+    stats_summary s = stats_.at(id);
+    shm_entry e;
+    e.sent = s.sent;
+    e.received = s.received;
+    e.lost = s.lost;
+    e.last_rtt = t.last_rtt;
+    e.srtt = t.rto.srtt() * 1000;
+    e.rttvar = t.rto.rttvar() * 1000;
+    e.rto = t.rto.rto() * 1000;
+    e.rtt_min = s.received ? s.rtt_min : 0;
+    e.rtt_max = s.rtt_max;
+    e.rtt_mean = s.rtt_mean;
+    e.updated = ns(now);
+    shm_->publish(id, e);
+  }
+
+  bool aligned() const { return opts_.align.total_microseconds() > 0; }
+
+  // An aligned send wakes up a little early and sleeps the rest on the
+  // realtime clock, so it leaves at the boundary rather than whenever the
+  // io_service gets to the timer.
+  void arm_send(std::size_t id, const posix_time::ptime& when) {
+    target& t = targets_[id];
+    if (aligned()) {
+      t.send_timer.expires_at(when - align_margin);
+      t.send_timer.async_wait(boost::bind(&pinger::handle_aligned_send, this, id, asio::placeholders::error));
+    } else {
+      t.send_timer.expires_at(when);
+      t.send_timer.async_wait(boost::bind(&pinger::start_send, this, id));
+    }
+  }
+
+  void handle_aligned_send(std::size_t id, const error_code& ec) {
+    if (ec) return;
+    long us = (targets_[id].next_send - epoch()).total_microseconds();
+    timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = us % 1000000 * 1000;
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+    start_send(id);
+  }
+
+  // Output not yet written by size goes out at least this often
+  void arm_flush() {
+    flush_timer_.expires_from_now(flush_interval);
+    flush_timer_.async_wait(boost::bind(&pinger::handle_flush, this, asio::placeholders::error));
+  }
+
+  void handle_flush(const error_code& ec) {
+    if (ec) return;
+    out_.flush();
+    if (sink_)
+      sink_->flush();
+    arm_flush();
+  }
+
+  bool summary() const { return opts_.summary.total_microseconds() > 0; }
+
+  // A line per probe, unless records or summaries take its place
+  bool probe_lines() const { return !records_ && !summary(); }
+
+  // Print the probes of the interval which just ended and start the next.
+  // The interval stores were fed by the same events as the others, so this
+  // costs a pass over the targets whatever the probe rate.
+  void handle_summary(const error_code& ec) {
+    if (ec) return;
+    auto end = summary_timer_.expires_at();
+    std::string title = fmt::format(FMT_COMPILE("--- {:.3f}-{:.3f} s ---"),
+        (end - opts_.summary - summary_start_).total_milliseconds() / 1000.0,
+        (end - summary_start_).total_milliseconds() / 1000.0);
+    out_.print(FMT_COMPILE("\n{:<30} {:>8} {:>8} {:>7} {:>9} {:>9} {:>9} {:>9}\n"),
+        title, "sent", "received", "loss", "min ms", "p50 ms", "p99 ms", "max ms");
+    stats_summary total = interval_->rollup(0, targets_.size());
+    for (std::size_t id = 0; id < targets_.size(); ++id) {
+      if (!opts_.summary_groups && targets_[id].active)
+        summary_line(targets_[id].host, interval_->at(id), interval_->histogram(id));
+      if (interval_->sent(id) || interval_->received(id) || interval_->lost(id))
+        interval_->clear(id);
+    }
+    for (std::size_t g = 0; g < group_names_.size(); ++g) {
+      summary_line("group " + group_names_.name(g), interval_groups_->at(g), interval_groups_->histogram(g));
+      interval_groups_->clear(g);
+    }
+    summary_line("total", total, interval_all_);
+    out_.flush();
+    interval_all_.reset();
+
+    summary_timer_.expires_at(end + opts_.summary);
+    summary_timer_.async_wait(boost::bind(&pinger::handle_summary, this, asio::placeholders::error));
+  }
+
+  // Loss is of the probes resolved in the interval, a reply may come in
+  // the interval after its probe was sent
+  void summary_line(const std::string& name, const stats_summary& s, const latency_histogram& h) {
+    double loss = s.received + s.lost ? 100.0 * s.lost / (s.received + s.lost) : 0.0;
+    if (s.received == 0) {
+      out_.print(FMT_COMPILE("{:<30} {:>8} {:>8} {:>6.2f}% {:>9} {:>9} {:>9} {:>9}\n"),
+          name, s.sent, s.received, loss, "-", "-", "-", "-");
+      return;
+    }
+    out_.print(FMT_COMPILE("{:<30} {:>8} {:>8} {:>6.2f}% {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f}\n"),
+        name, s.sent, s.received, loss, s.rtt_min / 1e6, h.percentile(50) / 1e6,
+        h.percentile(99) / 1e6, s.rtt_max / 1e6);
+  }
+
+  // Print the statistics so far and what changed since the last snapshot,
+  // without stopping. Like a scrape of the metrics, a snapshot reads the
+  // live stores snapshot_chunk entries at a time, each chunk in a handler of
+  // its own, so replies and timers run in between however many targets
+  // there are. Every entry is compared with its copy of the previous
+  // snapshot and then copied over it, that one copy is all a snapshot
+  // keeps. A busy target may thus be read a little later than another.
+  void handle_snapshot(const error_code& ec, int n) {
+    if (ec) return;
+    snapshot_signals_.async_wait(boost::bind(&pinger::handle_snapshot,
+          this, asio::placeholders::error, asio::placeholders::signal_number));
+    if (snapshot_progress_) {
+      std::cerr << "snapshot still in progress" << std::endl;
+      return;
+    }
+    if (!snapshot_) {
+      snapshot_.reset(new stats_store(stats_.capacity()));
+      snapshot_groups_.reset(new stats_store(groups_->capacity()));
+    }
+
+    auto now = posix_time::microsec_clock::universal_time();
+    snapshot_progress_.reset(new snapshot_progress);
+    snapshot_progress& p = *snapshot_progress_;
+    p.targets = targets_.size();
+    p.groups = group_names_.size();
+    p.seconds = (now - epoch()).total_seconds();
+    auto out = std::back_inserter(p.text);
+    fmt::format_to(out, FMT_COMPILE("\n--- snapshot at {:.3f} s"), (now - time_init_).total_milliseconds() / 1000.0);
+    if (!previous_snapshot_time_.is_not_a_date_time()) {
+      fmt::format_to(out, FMT_COMPILE(", interval {:.3f} s"),
+          (now - previous_snapshot_time_).total_milliseconds() / 1000.0);
+    }
+    fmt::format_to(out, FMT_COMPILE(" ---\n"));
+    previous_snapshot_time_ = now;
+    asio::post(io_service_, boost::bind(&pinger::continue_snapshot, this));
+  }
+
+  // Targets, the total and groups, in order, up to snapshot_chunk entries
+  void continue_snapshot() {
+    snapshot_progress& p = *snapshot_progress_;
+    std::size_t n = 0;
+    for (; p.target < p.targets && n < snapshot_chunk; ++p.target) {
+      std::size_t id = p.target;
+      stats_summary s = stats_.at(id), before = snapshot_->at(id);
+      p.total.merge(s);
+      p.total_before.merge(before);
+      p.histogram.merge(stats_.histogram(id));
+      p.histogram_before.merge(snapshot_->histogram(id));
+      snapshot_line(p.text, targets_[id].host, s, before, stats_.histogram(id), snapshot_->histogram(id));
+      if (targets_[id].windows) {
+        window_lines(p.text, "  ", *targets_[id].windows, p.seconds);
+        n += window_entries - 1;
+      }
+      snapshot_->copy(id, stats_, id);
+      ++n;
+    }
+    if (p.target == p.targets && p.targets > 1 && !p.total_done) {
+      snapshot_line(p.text, "total", p.total, p.total_before, p.histogram, p.histogram_before);
+      p.total_done = true;
+    }
+    for (; p.target == p.targets && p.group < p.groups && n < snapshot_chunk; ++p.group, ++n) {
+      std::size_t g = p.group;
+      snapshot_line(p.text, "group " + group_names_.name(g), groups_->at(g), snapshot_groups_->at(g),
+          groups_->histogram(g), snapshot_groups_->histogram(g));
+      snapshot_groups_->copy(g, *groups_, g);
+    }
+    if (p.target < p.targets || p.group < p.groups) {
+      asio::post(io_service_, boost::bind(&pinger::continue_snapshot, this));
+      return;
+    }
+    out_.print(FMT_COMPILE("{}"), fmt::string_view(p.text.data(), p.text.size()));
+    out_.flush();
+    snapshot_progress_.reset();
+  }
+
+  // An entry now and at the previous snapshot, zero before the first one
+  static void snapshot_line(fmt::memory_buffer& b, const std::string& name,
+      const stats_summary& s, const stats_summary& before,
+      const latency_histogram& h, const latency_histogram& before_h) {
+    stats_summary d = s;
+    d.sent -= before.sent;
+    d.received -= before.received;
+    d.lost -= before.lost;
+    d.rtt_sum -= before.rtt_sum;
+    latency_histogram dh = h;
+    dh.subtract(before_h);
+    fmt::format_to(std::back_inserter(b), FMT_COMPILE("{}: {} sent, {} received, {:.2f}% loss, "
+          "rtt avg/p50/p99 {:.3f}/{:.3f}/{:.3f} ms | interval +{} sent, +{} received, "
+          "{:.2f}% loss, rtt avg/p50/p99 {:.3f}/{:.3f}/{:.3f} ms\n"),
+        name, s.sent, s.received, s.sent ? 100.0 * (s.sent - s.received) / s.sent : 0.0,
+        s.rtt_mean / 1e6, h.percentile(50) / 1e6, h.percentile(99) / 1e6,
+        d.sent, d.received,
+        d.sent ? 100.0 * (d.sent - std::min(d.sent, d.received)) / d.sent : 0.0,
+        d.received ? static_cast<double>(d.rtt_sum) / d.received / 1e6 : 0.0,
+        dh.percentile(50) / 1e6, dh.percentile(99) / 1e6);
+  }
+
   void handle_termination(const error_code& ec, int n) {
+    if (control_)
+      control_->close();
     auto now = posix_time::microsec_clock::universal_time();
-    long double total_time = (now - time_init_).total_milliseconds() / 1000.0;
-    ttl_sum_ /= num_received_;
-    ttl_sum2_ /= num_received_;
-    long double ttl_mdev = sqrtl(ttl_sum2_ - ttl_sum_ * ttl_sum_);
-    std::cout << std::endl
-      << num_transmitted_ << " packets transmitted, "
-      << num_received_ << " received, "
-      << num_transmitted_ - num_received_ << " lossed, "
-      << std::fixed << std::setprecision(2)
-      << (num_transmitted_ - num_received_) / static_cast<long double>(num_transmitted_)
-      << "\% loss, time "
-      << std::setprecision(3) << total_time << " s\n"
-      << "rtt min/avg/max/mdev "
-      << ttl_min_ << "/"
-      << ttl_sum_ << "/"
-      << ttl_max_ << "/"
-      << ttl_mdev << " ms\n";
+    double total_time = (now - time_init_).total_milliseconds() / 1000.0;
+    for (std::size_t id = 0; id < targets_.size(); ++id) {
+      target& t = targets_[id];
+      out_.print(FMT_COMPILE("\n"));
+      if (targets_.size() > 1)
+        out_.print(FMT_COMPILE("--- {} ping statistics{} ---\n"), t.host, t.active ? "" : " (removed)");
+      print_statistics(out_, stats_.at(id), stats_.histogram(id), total_time);
+      out_.print(FMT_COMPILE("rto srtt/rttvar/rto {:.3f}/{:.3f}/{:.3f} ms\n"),
+          t.rto.srtt() / 1000.0, t.rto.rttvar() / 1000.0, t.rto.rto() / 1000.0);
+      if (t.gaps.count()) {
+        static const char* names[] = {"fixed", "poisson", "uniform"};
+        out_.print(FMT_COMPILE("schedule {} mean {:.3f} ms, {} gaps min/avg/max/sd "
+              "{:.3f}/{:.3f}/{:.3f}/{:.3f} ms, cv {:.3f}, P(gap<mean) {:.3f}, "
+              "lateness avg/max {:.3f}/{:.3f} ms, behind {}\n"),
+            names[t.schedule.type()], t.schedule.mean() / 1000.0, t.gaps.count(),
+            t.gaps.min() / 1000.0, t.gaps.mean() / 1000.0, t.gaps.max() / 1000.0,
+            t.gaps.stddev() / 1000.0, t.gaps.cv(), t.gaps.below_mean(),
+            t.gaps.mean_lateness() / 1000.0, t.gaps.max_lateness() / 1000.0, t.gaps.behind());
+      }
+      const auto& fwd = t.owd.forward();
+      const auto& rev = t.owd.reverse();
+      if (fwd.count) {
+        out_.print(FMT_COMPILE("one-way fwd min/avg/max {:.3f}/{:.3f}/{:.3f} ms, "
+              "rev min/avg/max {:.3f}/{:.3f}/{:.3f} ms\n"
+              "clock offset {:.3f} ms, drift {:.3f} ppm\n"),
+            fwd.min / 1000.0, fwd.avg() / 1000.0, fwd.max / 1000.0,
+            rev.min / 1000.0, rev.avg() / 1000.0, rev.max / 1000.0,
+            t.owd.offset() / 1000.0, t.owd.drift_ppm());
+      }
+      print_sequence(t);
+      if (opts_.changes) {
+        out_.print(FMT_COMPILE("rtt level {:.3f} ms, {} changes\n"),
+            t.level.baseline() / 1e6, t.level.changes());
+      }
+      if (t.windows)
+        print_windows(*t.windows, (now - epoch()).total_seconds());
+      if (series_ && series_->recorded(id)) {
+        std::uint64_t stored = series_->stored(id);
+        out_.print(FMT_COMPILE("series {} samples stored, {} evicted, {:.2f} bits/sample\n"),
+            stored, series_->recorded(id) - stored,
+            series_->bits(id) / static_cast<double>(stored));
+      }
+      if (t.trains.trains) {
+        out_.print(FMT_COMPILE("{} trains, capacity min/avg/max {:.3f}/{:.3f}/{:.3f} Mbit/s, "
+              "{} with loss, loss runs avg/max {:.3f}/{}\n"),
+            t.trains.trains, t.trains.capacity_min / 1e6, t.trains.capacity_avg() / 1e6,
+            t.trains.capacity_max / 1e6, t.trains.trains_with_loss,
+            t.trains.mean_loss_run(), t.trains.max_loss_run);
+      }
+    }
+    if (targets_.size() > 1) {
+      latency_histogram all;
+      stats_.merge_histograms(0, targets_.size(), all);
+      out_.print(FMT_COMPILE("\n--- {} targets ---\n"), targets_.size());
+      print_statistics(out_, stats_.rollup(0, targets_.size()), all, total_time);
+    }
+    for (std::size_t g = 0; g < group_names_.size(); ++g) {
+      out_.print(FMT_COMPILE("\n--- group {}, {} targets ---\n"),
+          group_names_.name(g), group_names_.members(g));
+      print_statistics(out_, groups_->at(g), groups_->histogram(g), total_time);
+    }
+    if (series_)
+      out_.print(FMT_COMPILE("series {} of {} KB\n"), series_->bytes() / 1024, series_->budget() / 1024);
+    if (records_)
+      write_summary_records(now, total_time);
+    if (sink_) {
+      std::uint64_t dropped = sink_->dropped();
+      // Hands over the last batch and waits for all to be released
+      sink_.reset();
+      if (dropped)
+        out_.print(FMT_COMPILE("{} results dropped, sink too slow\n"), dropped);
+    }
+    out_.flush();
+    if (!opts_.export_file.empty())
+      export_statistics((now - time_init_).total_microseconds());
+    if (series_ && !opts_.series_file.empty())
+      write_series();
+    // exit() skips the destructors, the segment is removed here
+    shm_.reset();
     exit(0);
   }
 
-  // Consider the time to send the message
-  // 1. First send, every thing is ok
-  // 2. Send after 5s's timeout call, and if the valid return message is
-  // arrived almost simultaneously or later.
-  //   1) If the sequence number has increased, so the message is
-  //   invalid
-  //   2) If the sequence number has not increased, we need to check
-  //   whether the received message is timeout:
-  //     i) If the send time is not reset, the message must be timeout,
-  //     then is invalid.
-  //     ii) If the send time is reset, the message may be deemed to have
-  //     arrived in time, but the sequence number has increased, so the message
-  //     is invalid too.
-  // 3. Send after a valid return message: since we have not sent the next
-  // message, there should be no valid return message to be received
-  void start_send() {
-    std::string body(56, 'z');
+  void write_summary_records(const posix_time::ptime& now, double total_time) {
+    double time = seconds(now);
+    for (std::size_t id = 0; id < targets_.size(); ++id)
+      records_->summary(time, "target", targets_[id].host, stats_.at(id), stats_.histogram(id), total_time);
+    latency_histogram all;
+    stats_.merge_histograms(0, targets_.size(), all);
+    records_->summary(time, "all", "all", stats_.rollup(0, targets_.size()), all, total_time);
+    for (std::size_t g = 0; g < group_names_.size(); ++g)
+      records_->summary(time, "group", group_names_.name(g), groups_->at(g), groups_->histogram(g), total_time);
+    records_->stop();
+    if (records_->dropped())
+      out_.print(FMT_COMPILE("{} records dropped, output too slow\n"), records_->dropped());
+  }
+
+  // One line per sample: host, send time in ms since the epoch and the round
+  // trip time in ms or "lost", to the microsecond
+  void write_series() {
+    std::ofstream os(opts_.series_file);
+    fmt::memory_buffer b;
+    auto out = std::back_inserter(b);
+    for (std::size_t id = 0; id < targets_.size(); ++id) {
+      series_->query(id, 0, std::numeric_limits<std::int64_t>::max(),
+          [&](std::int64_t time, std::int64_t rtt) {
+            fmt::format_to(out, FMT_COMPILE("{} "), targets_[id].host);
+            series_sample(b, time, rtt);
+            if (b.size() >= output::flush_bytes) {
+              os.write(b.data(), b.size());
+              b.clear();
+            }
+          });
+    }
+    os.write(b.data(), b.size());
+    if (!os.flush())
+      std::cerr << "cannot write " << opts_.series_file << "\n";
+  }
+
+  static void series_sample(fmt::memory_buffer& b, std::int64_t time, std::int64_t rtt) {
+    auto out = std::back_inserter(b);
+    fmt::format_to(out, FMT_COMPILE("{}.{:03}"), time / 1000, time % 1000);
+    if (rtt < 0)
+      fmt::format_to(out, FMT_COMPILE(" lost\n"));
+    else
+      fmt::format_to(out, FMT_COMPILE(" {}.{:03}\n"), rtt / 1000, rtt % 1000);
+  }
+
+  void export_statistics(std::uint64_t duration) {
+    stats_export e;
+    e.duration = duration;
+    for (std::size_t id = 0; id < targets_.size(); ++id)
+      e.records.push_back({targets_[id].host, stats_.at(id), stats_.histogram(id)});
+    std::ofstream os(opts_.export_file, std::ios::binary);
+    stats_file::write(os, e);
+    if (!os.flush())
+      std::cerr << "cannot write " << opts_.export_file << "\n";
+  }
+
+  void print_sequence(const target& t) {
+    const sequence_tracker& s = t.sequence;
+    if (s.reordered() || s.duplicates() || s.late()) {
+      out_.print(FMT_COMPILE("{} reordered, extent avg/max {:.2f}/{}, {} duplicates, {} late\n"),
+          s.reordered(), s.mean_extent(), s.max_extent(), s.duplicates(), s.late());
+    }
+    if (t.ipdv.count()) {
+      const auto& h = t.ipdv.histogram();
+      out_.print(FMT_COMPILE("ipdv |p50|/|p99|/|max|/mean {:.3f}/{:.3f}/{:.3f}/{:.3f} ms, jitter {:.3f} ms\n"),
+          h.percentile(50) / 1e6, h.percentile(99) / 1e6, h.max() / 1e6,
+          t.ipdv.mean() / 1e6, t.ipdv.jitter() / 1e6);
+    }
+    std::uint32_t runs = 0;
+    for (int i = 1; i <= sequence_tracker::max_run; ++i)
+      runs += s.loss_runs(i);
+    if (runs) {
+      out_.print(FMT_COMPILE("loss runs 1"));
+      for (int i = 2; i <= sequence_tracker::max_run; ++i)
+        out_.print(FMT_COMPILE("/{}"), i);
+      out_.print(FMT_COMPILE("+: {}"), s.loss_runs(1));
+      for (int i = 2; i <= sequence_tracker::max_run; ++i)
+        out_.print(FMT_COMPILE("/{}"), s.loss_runs(i));
+      out_.print(FMT_COMPILE("\n"));
+    }
+  }
+
+  void print_windows(const sliding_windows& windows, std::int64_t now) {
+    fmt::memory_buffer b;
+    window_lines(b, "", windows, now);
+    out_.print(FMT_COMPILE("{}"), fmt::string_view(b.data(), b.size()));
+  }
+
+  static void window_lines(fmt::memory_buffer& b, const char* indent,
+      const sliding_windows& windows, std::int64_t now) {
+    window_summary w[sliding_windows::window_count];
+    windows.summaries(now, w);
+    for (int i = 0; i < sliding_windows::window_count; ++i) {
+      fmt::format_to(std::back_inserter(b), FMT_COMPILE("{}last {}m: {} received, {} lost, "
+            "{:.2f}% loss, rtt p50/p99/max {:.3f}/{:.3f}/{:.3f} ms\n"),
+          indent, sliding_windows::minutes[i], w[i].received, w[i].lost, w[i].loss(),
+          w[i].p50 / 1e6, w[i].p99 / 1e6, w[i].max / 1e6);
+    }
+  }
+
+  // Every target has a window of probes in flight indexed by the sequence
+  // number. A probe leaves the window when
+  // 1. its first valid reply arrives before the deadline, later replies with
+  // the same sequence number are duplicates
+  // 2. the timeout timer finds it past its deadline, the timer always waits
+  // for the oldest pending probe
+  // 3. its slot is reused while it is still pending, it is lost as well;
+  // the window doubles instead until it reaches its size
+  //
+  // A round is a single probe, or a train of back-to-back probes in burst
+  // mode. Without a schedule the next round is sent one interval after the
+  // previous one, but only when all its probes have left the window. With a
+  // schedule the send times are drawn in advance and do not depend on the
+  // replies, a late send goes out at once and the following ones keep their
+  // schedule.
+  void start_send(std::size_t id) {
+    target& t = targets_[id];
+    if (!t.active) return;
+    auto now = posix_time::microsec_clock::universal_time();
+
+    // Aligned rounds are numbered by the grid, so samples of different
+    // processes have the same sequence number
+    unsigned short first = t.sequence_number + 1;
+    if (aligned() && (!opts_.open_loop || opts_.schedule == probe_schedule::fixed))
+      first = (t.next_send - epoch()).total_microseconds()
+        / opts_.interval.total_microseconds() * opts_.burst;
+    // The first round of this run, the counters may come from an earlier one
+    bool first_round = t.round_sent.is_not_a_date_time();
+    if (first_round)
+      t.oldest = first;
+
+    if (opts_.burst > 1) {
+      // A train still running under a schedule is cut short
+      if (t.train.active())
+        finish_train(id);
+      t.train.start(first, opts_.burst,
+          20 + 8 + (opts_.timestamp ? 12 : body_.size()));
+    }
+    for (std::size_t i = 0; i < opts_.burst; ++i) {
+      t.sequence_number = first + i;
+      send_probe(id);
+    }
+
+    if ((opts_.open_loop || aligned()) && !first_round)
+      t.gaps.record((now - t.round_sent).total_microseconds(),
+          (now - t.next_send).total_microseconds(), t.schedule.mean());
+    t.round_sent = now;
+    if (opts_.open_loop) {
+      t.next_send += posix_time::microseconds(t.schedule.next_gap());
+      if (t.next_send < now)
+        t.gaps.fell_behind();
+      arm_send(id, t.next_send);
+    }
+  }
+
+  void send_probe(std::size_t id) {
+    target& t = targets_[id];
+    auto now = posix_time::microsec_clock::universal_time();
 
     // Construct header
     // The protocol of ip::icmp is IPPROTO_ICMP, so the kernel will
     // automatically add the correct ip header
     icmp_header echo_request;
-    echo_request.type(icmp_header::echo_request);
-    echo_request.code(0); // for echo request/reply
-    echo_request.identifier(get_identifier());
-    echo_request.sequence_number(++sequence_number_);
-    compute_checksum(echo_request, body.begin(), body.end());
-    ++num_transmitted_;
+    echo_request.type(opts_.timestamp ? icmp_header::timestamp_request
+        : icmp_header::echo_request);
+    echo_request.code(0); // for echo and timestamp request/reply
+    echo_request.identifier(identifier(id));
+    echo_request.sequence_number(t.sequence_number);
+    icmp_timestamp timestamp;
+    if (opts_.timestamp) {
+      timestamp.originate(us_since_midnight(now) / 1000);
+      compute_checksum(echo_request, timestamp.begin(), timestamp.end());
+    } else {
+      if (id_in_data()) {
+        for (int i = 0; i < 4; ++i)
+          body_[i] = static_cast<char>(id >> (24 - 8 * i));
+      }
+      compute_checksum(echo_request, body_.begin(), body_.end());
+    }
+    stats_.on_sent(id);
+    for (std::size_t g : t.groups)
+      groups_->on_sent(g);
+    if (interval_) {
+      interval_->on_sent(id);
+      for (std::size_t g : t.groups)
+        interval_groups_->on_sent(g);
+    }
+
+    while (t.slot(t.sequence_number).pending && t.window.size() < opts_.window)
+      t.grow();
+    probe& p = t.slot(t.sequence_number);
+    if (p.pending)
+      handle_loss(id, p);
 
     // Encode
-    asio::streambuf request_buffer;
-    std::ostream os(&request_buffer);
-    os << echo_request << body;
+    request_buffer_.consume(request_buffer_.size());
+    std::ostream os(&request_buffer_);
+    os << echo_request;
+    if (opts_.timestamp)
+      os << timestamp;
+    else
+      os << body_;
 
-    // Send request
-    time_sent_ = posix_time::microsec_clock::universal_time();
-    socket_.send_to(request_buffer.data(), destination_);
+    // Send request, a failure leaves the probe to time out
+    error_code ec;
+    socket_.send_to(request_buffer_.data(), t.destination, 0, ec);
+    if (ec) {
+      if (log_)
+        log_->append({ns(now), 0, static_cast<std::uint32_t>(id), t.sequence_number, probe_entry::error, 0});
+      if (sink_)
+        sink_result(id, now, 0, t.sequence_number, NETTOOL_ERROR, 0, 0);
+      if (records_) {
+        records_->error(seconds(now), t.host, t.destination.address().to_string(),
+            t.sequence_number, ec.message());
+      } else if (probe_lines()) {
+        out_.print(FMT_COMPILE("{} icmp_seq={}: {}\n"), t.host, t.sequence_number, ec.message());
+        out_.end_line();
+      }
+    }
 
-    // Set a timer of 5s, whose handle may be called when a valid message is
-    // detected.
-    num_replies_ = 0;
-    timer_.expires_at(time_sent_ + posix_time::seconds(5));
-    timer_.async_wait(boost::bind(&pinger::handle_timeout, this, asio::placeholders::error));
+    p.sequence_number = t.sequence_number;
+    p.pending = true;
+    p.num_replies = 0;
+    p.rtt = -1;
+    p.time_sent = now;
+    p.deadline = now + posix_time::microseconds(t.rto.rto());
+    if (shm_)
+      publish(id, now);
+    if (state_)
+      save(id);
+    if (!t.timeout_armed) {
+      t.timeout_armed = true;
+      t.timeout_timer.expires_at(p.deadline);
+      t.timeout_timer.async_wait(boost::bind(&pinger::handle_timeout, this, id, asio::placeholders::error));
+    }
   }
 
-  void handle_timeout(const error_code& ec) {
-    if (num_replies_ == 0 && !ec)
-      std::cout << "Request timed out" << std::endl;
-    if (ec && ec.value() != boost::system::errc::operation_canceled)
-      std::cerr << ec.message() << std::endl;
+  // Expire every probe past its deadline and wait for the next one
+  void handle_timeout(std::size_t id, const error_code& ec) {
+    target& t = targets_[id];
+    if (ec) {
+      if (ec.value() != boost::system::errc::operation_canceled)
+        std::cerr << ec.message() << std::endl;
+      return;
+    }
+    if (!t.active) return;
+
+    auto now = posix_time::microsec_clock::universal_time();
+    unsigned short end = t.sequence_number + 1;
+    for (; t.oldest != end; ++t.oldest) {
+      probe& p = t.slot(t.oldest);
+      if (!p.pending || p.sequence_number != t.oldest) continue;
+      if (p.deadline > now) {
+        t.timeout_timer.expires_at(p.deadline);
+        t.timeout_timer.async_wait(boost::bind(&pinger::handle_timeout, this, id, asio::placeholders::error));
+        return;
+      }
+      handle_loss(id, p);
+    }
+    t.timeout_armed = false;
+  }
 
-    // Send the next request after at least 1s
-    timer_.expires_at(time_sent_ + posix_time::seconds(1));
-    timer_.async_wait(boost::bind(&pinger::start_send, this));
+  void report_rule(const sla_engine::transition& tr) {
+    out_.print(FMT_COMPILE("rule {} {} {}, "), tr.rule.text,
+        tr.target == sla_engine::scope_target ? tr.rule.scope : targets_[tr.target].host,
+        tr.firing ? "firing" : "resolved");
+    switch (tr.rule.metric) {
+      case sla_rule::loss:
+        out_.print(FMT_COMPILE("{:.2f}% loss\n"), tr.value * 100);
+        break;
+      case sla_rule::percentile:
+        out_.print(FMT_COMPILE("{:.2f}% of replies above {:.3f} ms\n"),
+            tr.value * 100, tr.rule.threshold / 1e6);
+        break;
+      case sla_rule::mean:
+        out_.print(FMT_COMPILE("avg {:.3f} ms\n"), tr.value / 1e6);
+        break;
+    }
+    out_.end_line();
+  }
+
+  void handle_loss(std::size_t id, probe& p) {
+    target& t = targets_[id];
+    p.pending = false;
+    stats_.on_loss(id);
+    for (std::size_t g : t.groups)
+      groups_->on_loss(g);
+    if (interval_) {
+      interval_->on_loss(id);
+      for (std::size_t g : t.groups)
+        interval_groups_->on_loss(g);
+    }
+    t.sequence.on_loss(p.sequence_number);
+    if (t.windows)
+      t.windows->on_loss((posix_time::microsec_clock::universal_time() - epoch()).total_seconds());
+    if (series_)
+      series_->record(id, (p.time_sent - epoch()).total_microseconds(), -1);
+    if (!rules_.empty()) {
+      rules_.on_loss(id, (posix_time::microsec_clock::universal_time() - epoch()).total_milliseconds(),
+          [this](const sla_engine::transition& tr) { report_rule(tr); });
+    }
+    t.rto.backoff();
+    if (log_)
+      log_->append({ns(p.time_sent), 0, static_cast<std::uint32_t>(id), p.sequence_number, probe_entry::timeout, 0});
+    if (sink_)
+      sink_result(id, p.time_sent, 0, p.sequence_number, NETTOOL_TIMEOUT, 0, 0);
+    if (shm_)
+      publish(id, posix_time::microsec_clock::universal_time());
+    if (state_)
+      save(id);
+    if (records_) {
+      records_->timeout(seconds(posix_time::microsec_clock::universal_time()), t.host,
+          t.destination.address().to_string(), p.sequence_number);
+    }
+    if (opts_.burst > 1) {
+      if (t.train.loss(p.sequence_number))
+        finish_train(id);
+      return;
+    }
+    if (probe_lines()) {
+      if (targets_.size() > 1)
+        out_.print(FMT_COMPILE("Request timed out: {} icmp_seq={}\n"), t.host, p.sequence_number);
+      else
+        out_.print(FMT_COMPILE("Request timed out\n"));
+      out_.end_line();
+    }
+    if (p.sequence_number == t.sequence_number)
+      schedule_next(id);
+  }
+
+  void finish_train(std::size_t id) {
+    target& t = targets_[id];
+    const packet_train& train = t.train;
+    t.trains.record(train);
+    std::size_t max_run = 0;
+    train.for_each_loss_run([&max_run](std::size_t run) {
+      max_run = std::max(max_run, run);
+    });
+    if (!summary()) {
+      out_.print(FMT_COMPILE("train to {}: {}/{} received, dispersion {:.3f} ms, "
+            "capacity {:.3f} Mbit/s, lost {} (longest run {})\n"),
+          t.destination.address().to_string(), train.received_count(), train.length(),
+          train.dispersion() / 1e6, train.capacity() / 1e6, train.lost_count(), max_run);
+      out_.end_line();
+    }
+    schedule_next(id);
+  }
+
+  // Without a schedule, send the next round after at least one interval
+  void schedule_next(std::size_t id) {
+    target& t = targets_[id];
+    if (opts_.open_loop) return;
+    if (aligned()) {
+      // Skip the rounds which are already over
+      auto now = posix_time::microsec_clock::universal_time();
+      do t.next_send += opts_.interval; while (t.next_send < now);
+    } else {
+      t.next_send = t.round_sent + opts_.interval;
+    }
+    arm_send(id, t.next_send);
   }
 
   void start_receive() {
-    // Discard possible data
-    reply_buffer_.consume(reply_buffer_.size());
-    // Prepare the buffer for at most 64KB data
-    socket_.async_receive(reply_buffer_.prepare(65536),
-        boost::bind(&pinger::handle_receive, this, asio::placeholders::error, asio::placeholders::bytes_transferred));
+    socket_.async_wait(icmp::socket::wait_read,
+        boost::bind(&pinger::handle_receive, this, asio::placeholders::error));
   }
 
-  void handle_receive(const error_code& ec, std::size_t length) {
-    if (ec)
+  // Drain every datagram queued on the socket, each with the time the kernel
+  // received it rather than the time we got around to read it
+  void handle_receive(const error_code& ec) {
+    if (ec) {
       std::cerr << ec.message() << std::endl;
-    else {
-      reply_buffer_.commit(length);
+      start_receive();
+      return;
+    }
+
+    for (;;) {
+      // Discard possible data
+      reply_buffer_.consume(reply_buffer_.size());
+      // Prepare the buffer for at most 64KB data
+      auto buffer = reply_buffer_.prepare(65536);
+      iovec iov;
+      iov.iov_base = buffer.data();
+      iov.iov_len = buffer.size();
+      char control[CMSG_SPACE(sizeof(timespec))];
+      msghdr msg = {};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      ssize_t length = ::recvmsg(socket_.native_handle(), &msg, MSG_DONTWAIT);
+      if (length < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+          std::cerr << error_code(errno, boost::system::system_category()).message() << std::endl;
+        break;
+      }
 
-      // Discard timeout return message
-      posix_time::ptime tmp = posix_time::microsec_clock::universal_time();
-      if ((tmp - time_sent_).total_milliseconds() > 5000) return;
-
-      // Decode
-      std::istream is(&reply_buffer_);
-      ipv4_header ipv4_hdr;
-      icmp_header icmp_hdr;
-      is >> ipv4_hdr >> icmp_hdr;
-
-      // Filter the message we are interested
-      if (is && icmp_hdr.type() == icmp_header::echo_reply
-          && icmp_hdr.identifier() == get_identifier()
-          && icmp_hdr.sequence_number() == sequence_number_) {
-        // Call handle_timeout only when the first valid message arrive
-        if (num_replies_++ == 0)
-          timer_.cancel();
-
-        posix_time::ptime now = posix_time::microsec_clock::universal_time();
-        ++num_received_;
-        long double ttl = (now - time_sent_).total_microseconds() / 1000.0;
-        ttl_min_ = fmin(ttl_min_, ttl);
-        ttl_max_ = fmax(ttl_max_, ttl);
-        ttl_sum_ += ttl;
-        ttl_sum2_ += ttl * ttl;
-        std::cout << length - ipv4_hdr.header_length()
-          << " bytes from " << ipv4_hdr.source_address()
-          << ": icmp_seq=" << icmp_hdr.sequence_number()
-          << ", ttl=" << ipv4_hdr.time_to_live()
-          << ", time=" << std::fixed << std::setprecision(3)
-          << ttl << " ms"
-          << std::endl;
+      // The kernel time in ns as well, ptime only keeps microseconds
+      posix_time::ptime now;
+      std::uint64_t now_ns = 0;
+      for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+          timespec ts;
+          memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+          now = epoch() + posix_time::seconds(ts.tv_sec)
+            + posix_time::microseconds(ts.tv_nsec / 1000);
+          now_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        }
       }
+      if (now.is_not_a_date_time()) {
+        now = posix_time::microsec_clock::universal_time();
+        now_ns = ns(now);
+      }
+
+      reply_buffer_.commit(length);
+      handle_reply(length, now, now_ns);
     }
     start_receive();
   }
 
+  void handle_reply(std::size_t length, const posix_time::ptime& now, std::uint64_t now_ns) {
+    // Decode
+    std::istream is(&reply_buffer_);
+    ipv4_header ipv4_hdr;
+    icmp_header icmp_hdr;
+    is >> ipv4_hdr >> icmp_hdr;
+    if (is && icmp_error(icmp_hdr.type())) {
+      handle_icmp_error(is, ipv4_hdr, icmp_hdr, now);
+      return;
+    }
+
+    icmp_timestamp timestamp;
+    unsigned char data[4] = {};
+    if (opts_.timestamp)
+      is >> timestamp;
+    else if (id_in_data())
+      is.read(reinterpret_cast<char*>(data), sizeof(data));
+
+    // Filter the message we are interested, whatever address it comes from
+    std::size_t id;
+    if (!is || icmp_hdr.type() != (opts_.timestamp ? icmp_header::timestamp_reply
+          : icmp_header::echo_reply)
+        || !probe_target(icmp_hdr, data, id))
+      return;
+
+    target& t = targets_[id];
+    unsigned short seq = icmp_hdr.sequence_number();
+    probe& p = t.slot(seq);
+    // Only the first message before the deadline resolves the probe,
+    // duplicates and timeout return messages are discarded
+    if (p.sequence_number != seq) return;
+    if (p.num_replies++ != 0) {
+      if (p.rtt < 0) return;
+      t.sequence.on_duplicate();
+      // Every host answering a broadcast gets its line
+      if (probe_lines()) {
+        out_.print(FMT_COMPILE("{} bytes from {}: icmp_seq={}, ttl={}, time={:.3f} ms (DUP!)\n"),
+            length - ipv4_hdr.header_length(), sender(ipv4_hdr.source_address()), seq,
+            ipv4_hdr.time_to_live(), (now - p.time_sent).total_microseconds() / 1000.0);
+        out_.end_line();
+      }
+      return;
+    }
+    if (!p.pending || now > p.deadline) {
+      t.sequence.on_late();
+      return;
+    }
+
+    p.pending = false;
+    t.rto.update((now - p.time_sent).total_microseconds());
+
+    std::int64_t rtt = (now - p.time_sent).total_microseconds();
+    p.rtt = std::max<std::int64_t>(rtt, 0) * 1000;
+    stats_.on_reply(id, p.rtt);
+    t.last_rtt = p.rtt;
+    if (shm_)
+      publish(id, now);
+    if (state_)
+      save(id);
+    for (std::size_t g : t.groups)
+      groups_->on_reply(g, p.rtt);
+    if (interval_) {
+      interval_->on_reply(id, p.rtt);
+      interval_all_.record(p.rtt);
+      for (std::size_t g : t.groups)
+        interval_groups_->on_reply(g, p.rtt);
+    }
+    t.sequence.on_reply(seq);
+    // Delay variation with the neighbours, whichever arrived first
+    const probe& prev = t.slot(seq - 1);
+    if (prev.sequence_number == static_cast<unsigned short>(seq - 1) && prev.rtt >= 0)
+      t.ipdv.record(p.rtt - prev.rtt);
+    const probe& next = t.slot(seq + 1);
+    if (next.sequence_number == static_cast<unsigned short>(seq + 1) && next.rtt >= 0)
+      t.ipdv.record(next.rtt - p.rtt);
+    if (t.windows)
+      t.windows->on_reply((now - epoch()).total_seconds(), std::max<std::int64_t>(rtt, 0) * 1000);
+    if (series_)
+      series_->record(id, (p.time_sent - epoch()).total_microseconds(), p.rtt / 1000);
+    change_detector::change change;
+    if (opts_.changes && t.level.update(p.rtt, change)) {
+      out_.print(FMT_COMPILE("change {} rtt {} {:.3f} -> {:.3f} ms after {} samples\n"),
+          t.host, change.up ? "up" : "down", change.before / 1e6, change.after / 1e6, change.delay);
+      out_.end_line();
+    }
+    if (!rules_.empty()) {
+      rules_.on_reply(id, (now - epoch()).total_milliseconds(), p.rtt,
+          [this](const sla_engine::transition& tr) { report_rule(tr); });
+    }
+    double ttl = rtt / 1000.0;
+    if (log_) {
+      log_->append({ns(p.time_sent), now_ns, static_cast<std::uint32_t>(id), seq,
+          probe_entry::reply, static_cast<std::uint8_t>(ipv4_hdr.time_to_live())});
+    }
+    if (sink_) {
+      sink_result(id, p.time_sent, p.rtt, seq, NETTOOL_REPLY, ipv4_hdr.time_to_live(),
+          length - ipv4_hdr.header_length());
+    }
+    if (records_) {
+      records_->reply(seconds(now), t.host, ipv4_hdr.source_address().to_string(),
+          seq, ipv4_hdr.time_to_live(), length - ipv4_hdr.header_length(), ttl);
+    }
+
+    bool owd = opts_.timestamp && timestamp.standard();
+    if (owd) {
+      t.owd.update(us_since_midnight(p.time_sent),
+          timestamp.receive() * 1000LL, timestamp.transmit() * 1000LL,
+          us_since_midnight(now));
+    }
+
+    // A train reports once it is over
+    if (opts_.burst > 1) {
+      if (t.train.reply(p.sequence_number, static_cast<std::int64_t>(now_ns)))
+        finish_train(id);
+      return;
+    }
+    if (probe_lines()) {
+      out_.print(FMT_COMPILE("{} bytes from {}: icmp_seq={}, ttl={}, time={:.3f} ms"),
+          length - ipv4_hdr.header_length(), sender(ipv4_hdr.source_address()),
+          icmp_hdr.sequence_number(),
+          ipv4_hdr.time_to_live(), ttl);
+      if (owd) {
+        out_.print(FMT_COMPILE(", fwd={:.3f} ms, rev={:.3f} ms, offset={:.3f} ms"),
+            t.owd.last_forward() / 1000.0, t.owd.last_reverse() / 1000.0, t.owd.last_offset() / 1000.0);
+      } else if (opts_.timestamp) {
+        out_.print(FMT_COMPILE(", non-standard timestamps"));
+      }
+      out_.print(FMT_COMPILE("\n"));
+      out_.end_line();
+    }
+    if (p.sequence_number == t.sequence_number)
+      schedule_next(id);
+  }
+
+  static bool icmp_error(int type) {
+    return type == icmp_header::destination_unreachable || type == icmp_header::time_exceeded
+      || type == icmp_header::parameter_problem || type == icmp_header::source_quench;
+  }
+
+  static std::string icmp_error_text(int type, int code) {
+    static const char* const unreachable[] = {
+      "Destination Net Unreachable", "Destination Host Unreachable",
+      "Destination Protocol Unreachable", "Destination Port Unreachable",
+      "Frag needed and DF set", "Source Route Failed",
+      "Destination Net Unknown", "Destination Host Unknown", "Source Host Isolated",
+      "Destination Net Prohibited", "Destination Host Prohibited",
+      "Destination Net Unreachable for Type of Service",
+      "Destination Host Unreachable for Type of Service",
+      "Packet filtered", "Precedence Violation", "Precedence Cutoff"
+    };
+    switch (type) {
+      case icmp_header::destination_unreachable:
+        if (code < 16) return unreachable[code];
+        return fmt::format(FMT_COMPILE("Destination Unreachable, Bad Code: {}"), code);
+      case icmp_header::time_exceeded:
+        return code == 0 ? "Time to live exceeded" : "Frag reassembly time exceeded";
+      case icmp_header::parameter_problem:
+        return "Parameter problem";
+      default:
+        return "Source Quench";
+    }
+  }
+
+  // An ICMP error quotes the IP header and at least 8 bytes of the datagram
+  // which caused it, routers usually more. An error about one of our probes
+  // is reported with the address and name of its sender, whoever that is.
+  // It resolves nothing: the probe times out as it would without it.
+  void handle_icmp_error(std::istream& is, const ipv4_header& ipv4_hdr,
+      const icmp_header& icmp_hdr, const posix_time::ptime& now) {
+    ipv4_header quoted_ip;
+    icmp_header quoted;
+    is >> quoted_ip >> quoted;
+    if (!is || quoted_ip.protocol() != IPPROTO_ICMP
+        || quoted.type() != (opts_.timestamp ? icmp_header::timestamp_request : icmp_header::echo_request))
+      return;
+    unsigned char data[4] = {};
+    bool whole = static_cast<bool>(is.read(reinterpret_cast<char*>(data), sizeof(data)));
+    std::size_t id;
+    if (whole || !id_in_data()) {
+      if (!probe_target(quoted, data, id)) return;
+    } else {
+      // Only the headers are quoted, the destination tells the target
+      const target_table& index = table();
+      auto it = index.index.find(quoted_ip.destination_address().to_uint());
+      if (quoted.identifier() != get_identifier() || it == index.index.end()) return;
+      id = it->second;
+    }
+
+    const target& t = targets_[id];
+    std::string message = icmp_error_text(icmp_hdr.type(), icmp_hdr.code());
+    if (records_) {
+      records_->error(seconds(now), t.host, ipv4_hdr.source_address().to_string(),
+          quoted.sequence_number(), message);
+    } else if (probe_lines()) {
+      out_.print(FMT_COMPILE("From {} icmp_seq={}: {}"),
+          sender(ipv4_hdr.source_address()), quoted.sequence_number(), message);
+      if (targets_.size() > 1)
+        out_.print(FMT_COMPILE(" ({})"), t.host);
+      out_.print(FMT_COMPILE("\n"));
+      out_.end_line();
+    }
+  }
+
+  // Address of a sender as printed, with its name once it is known
+  std::string sender(const asio::ip::address_v4& address) {
+    const std::string* name = names_ ? names_->find(address.to_uint()) : nullptr;
+    if (!name) return address.to_string();
+    return fmt::format(FMT_COMPILE("{} ({})"), *name, address.to_string());
+  }
+
   static unsigned short get_identifier() {
     return static_cast<unsigned short>(::getpid());
   }
 
+  // The target of an echo request is in its first 4 bytes of data. A
+  // timestamp request has no data of its own, nor has an echo request of
+  // less than 4 bytes, so the target is added to the identifier instead.
+  bool id_in_data() const { return !opts_.timestamp && body_.size() >= 4; }
+
+  unsigned short identifier(std::size_t id) const {
+    return id_in_data() ? get_identifier() : static_cast<unsigned short>(get_identifier() + id);
+  }
+
+  // Target of a probe from its ICMP header and the first 4 bytes of its
+  // data, false if the probe is not one of ours
+  bool probe_target(const icmp_header& h, const unsigned char* data, std::size_t& id) const {
+    if (id_in_data()) {
+      if (h.identifier() != get_identifier()) return false;
+      id = static_cast<std::size_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+    } else {
+      id = static_cast<unsigned short>(h.identifier() - get_identifier());
+    }
+    return id < targets_.size() && targets_[id].active;
+  }
+
+  const options& opts_;
+  asio::io_service& io_service_;
   icmp::resolver resolver_;
-  icmp::endpoint destination_;
   icmp::socket socket_; // raw socket
-  deadline_timer timer_;
-  unsigned short sequence_number_;
-  posix_time::ptime time_sent_;
   asio::streambuf reply_buffer_;
-  std::size_t num_replies_;
+  asio::streambuf request_buffer_;
+  // Echo data, the target id goes into its first 4 bytes, see id_in_data()
+  std::string body_;
+  std::vector<target> targets_;
+  // With a state file the stores live in it, and the groups too if they fit
+  std::unique_ptr<state_file> state_;
+  stats_store stats_;
+  std::unique_ptr<series_store> series_;
+  group_table group_names_;
+  std::unique_ptr<stats_store> groups_;
+  sla_engine rules_;
+  // Read by the receive path without a lock to match ICMP errors, see
+  // publish_table()
+  std::atomic<const target_table*> table_{nullptr};
+  bool started_ = false;
+  // The targets of the state file have their ids of this run
+  bool restored_ = false;
+  bool state_groups_ = false;
+  // Group of each scoped rule, scope_target if it covers every target
+  std::vector<std::size_t> rule_groups_;
+  std::vector<std::string> metric_labels_;
+  std::unique_ptr<control_server> control_;
 
   asio::signal_set signals_;
   posix_time::ptime time_init_;
-  std::size_t num_transmitted_;
-  std::size_t num_received_;
-  long double ttl_min_;
-  long double ttl_max_;
-  long double ttl_sum_;
-  long double ttl_sum2_;
+
+  // A snapshot under way, see handle_snapshot()
+  struct snapshot_progress {
+    fmt::memory_buffer text;
+    // Entries to print and the next ones
+    std::size_t targets = 0;
+    std::size_t groups = 0;
+    std::size_t target = 0;
+    std::size_t group = 0;
+    // All targets now and at the previous snapshot
+    stats_summary total;
+    stats_summary total_before;
+    latency_histogram histogram;
+    latency_histogram histogram_before;
+    bool total_done = false;
+    // Time of the sliding windows, seconds since the epoch
+    std::int64_t seconds = 0;
+  };
+
+  asio::signal_set snapshot_signals_;
+  // The stores as of the previous snapshot, from the first one on
+  std::unique_ptr<stats_store> snapshot_;
+  std::unique_ptr<stats_store> snapshot_groups_;
+  std::unique_ptr<snapshot_progress> snapshot_progress_;
+  posix_time::ptime previous_snapshot_time_;
+
+  output out_;
+  deadline_timer flush_timer_;
+  // Events of the current summary interval, all targets in interval_all_
+  std::unique_ptr<stats_store> interval_;
+  std::unique_ptr<stats_store> interval_groups_;
+  latency_histogram interval_all_;
+  deadline_timer summary_timer_;
+  posix_time::ptime summary_start_;
+  std::unique_ptr<record_writer> records_;
+  std::unique_ptr<probe_log> log_;
+  std::unique_ptr<metrics_server> metrics_;
+  std::unique_ptr<shm_stats> shm_;
+  std::unique_ptr<result_sink> sink_;
+  std::unique_ptr<name_cache> names_;
+
+  static const posix_time::time_duration align_margin;
+  static const posix_time::time_duration flush_interval;
+  static const std::size_t record_buffer = 4 << 20;
+  // Entries of a snapshot per handler, about a millisecond
+  static const std::size_t snapshot_chunk = 256;
+  // The sliding windows of a target take as long as that many entries
+  static const std::size_t window_entries = 4;
 };
 
+const posix_time::time_duration pinger::align_margin = posix_time::milliseconds(1);
+const posix_time::time_duration pinger::flush_interval = posix_time::milliseconds(200);
+
+// Combine the statistics files named in hosts, print them as at the end of
+// a run and export the result if asked to
+int merge_files(const options& opts) {
+  stats_export merged;
+  for (const auto& file : opts.hosts) {
+    std::ifstream is(file, std::ios::binary);
+    if (!is) {
+      std::cerr << "cannot open " << file << "\n";
+      return 1;
+    }
+    stats_file::merge(merged, stats_file::read(is));
+  }
+  double total_time = merged.duration / 1e6;
+  stats_summary all;
+  latency_histogram all_h;
+  output out;
+  for (const auto& r : merged.records) {
+    out.print(FMT_COMPILE("\n--- {} ping statistics ---\n"), r.name);
+    print_statistics(out, r.stats, r.histogram, total_time);
+    all.merge(r.stats);
+    all_h.merge(r.histogram);
+  }
+  if (merged.records.size() > 1) {
+    out.print(FMT_COMPILE("\n--- {} targets ---\n"), merged.records.size());
+    print_statistics(out, all, all_h, total_time);
+  }
+  out.flush();
+  if (!opts.export_file.empty()) {
+    std::ofstream os(opts.export_file, std::ios::binary);
+    stats_file::write(os, merged);
+    if (!os.flush()) {
+      std::cerr << "cannot write " << opts.export_file << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Print the records of a probe log, oldest first, as text or CSV
+int read_log(const options& opts) {
+  output out;
+  if (opts.format == record_format::csv)
+    out.print(FMT_COMPILE("tx_ns,rx_ns,host,address,seq,outcome,ttl,rtt_ms\n"));
+  static const char* const outcomes[] = {"reply", "timeout", "error"};
+  for (const auto& file : opts.hosts) {
+    probe_log_reader log(file);
+    const auto& targets = log.targets();
+    std::uint64_t skipped = log.for_each([&](const probe_entry& e) {
+      const auto& t = targets[e.target];
+      const char* outcome = e.outcome <= probe_entry::error ? outcomes[e.outcome] : "unknown";
+      double rtt = e.outcome == probe_entry::reply ? (e.rx - e.tx) / 1e6 : 0;
+      if (opts.format == record_format::csv) {
+        out.print(FMT_COMPILE("{},{},{},{},{},{},"), e.tx, e.rx, t.host, t.address, e.seq, outcome);
+        if (e.outcome == probe_entry::reply)
+          out.print(FMT_COMPILE("{},{:.3f}\n"), e.ttl, rtt);
+        else
+          out.print(FMT_COMPILE(",\n"));
+      } else {
+        out.print(FMT_COMPILE("{}.{:06} {} ({}) icmp_seq={} {}"),
+            e.tx / 1000000000, e.tx / 1000 % 1000000, t.host, t.address, e.seq, outcome);
+        if (e.outcome == probe_entry::reply)
+          out.print(FMT_COMPILE(" ttl={} time={:.3f} ms"), e.ttl, rtt);
+        out.print(FMT_COMPILE("\n"));
+      }
+      out.end_line();
+    });
+    out.flush();
+    std::uint64_t written = log.written();
+    if (written > log.capacity())
+      std::cerr << file << ": " << written - log.capacity() + 1 << " older records overwritten\n";
+    if (skipped)
+      std::cerr << file << ": " << skipped << " records overwritten while reading\n";
+  }
+  return 0;
+}
+
+// Parse "1.5" seconds or milliseconds into a duration
+posix_time::time_duration parse_duration(const char* arg, double scale) {
+  std::size_t pos = 0;
+  double v = std::stod(arg, &pos);
+  if (arg[pos] != '\0' || v < 0)
+    throw std::invalid_argument(std::string("invalid duration: ") + arg);
+  return posix_time::microseconds(static_cast<long>(v * scale));
+}
+
+void usage() {
+  std::cerr << "Usage: ping [options] <host>...\n"
+    << "       ping --merge [--export <file>] <file>...\n"
+    << "       ping --control <socket> [options] [<host>...]\n"
+    << "       ping --read-log [--format text|csv] <file>...\n"
+    << "  -i, --interval <s>     seconds between probes of a target (default 1)\n"
+    << "      --rto-min <ms>     lower bound of the adaptive timeout (default 200)\n"
+    << "      --rto-max <ms>     upper and initial timeout (default 5000)\n"
+    << "      --schedule <kind>  send on a schedule independent of the replies,\n"
+    << "                         fixed, poisson or uniform gaps of mean interval\n"
+    << "      --jitter <f>       relative spread of uniform gaps (default 0.5)\n"
+    << "      --seed <n>         seed of the gap generator\n"
+    << "      --window <n>       probes in flight per target (default twice\n"
+    << "                         those sent within --rto-max, at least 16)\n"
+    << "      --align <ms>       start on a multiple of the period since the epoch\n"
+    << "                         and keep the rounds on the grid of the interval\n"
+    << "      --timestamp        send ICMP timestamp requests, estimate one-way\n"
+    << "                         delays and the clock offset of the targets\n"
+    << "  -b, --burst <n>        send trains of n back-to-back probes, estimate\n"
+    << "                         the bottleneck capacity and burst loss\n"
+    << "  -s, --size <bytes>     bytes of echo data (default 56)\n"
+    << "      --windows          keep 1, 5 and 15 minute sliding windows\n"
+    << "      --export <file>    write mergeable binary statistics at the end\n"
+    << "      --merge            combine statistics files of several runs\n"
+    << "      --series <MB>      keep every probe result, compressed, within\n"
+    << "                         this memory budget, oldest dropped first\n"
+    << "      --series-out <file> write the kept probe results at the end\n"
+    << "      --rule <rule>      report when a rule starts or stops firing, e.g.\n"
+    << "                         'loss > 2% over 60s', 'p99 > 20ms over 5m',\n"
+    << "                         'avg > 50ms over 1m', 'all:' for all targets\n"
+    << "                         or '<group>:' for a group\n"
+    << "      --group-subnet <n> group the targets by subnet of prefix length n\n"
+    << "      --changes          report level shifts of the round trip time\n"
+    << "      --format <f>       text, or json (JSON Lines) or csv records of\n"
+    << "                         every probe and summary on standard output,\n"
+    << "                         the text going to standard error\n"
+    << "      --log <file>       record every probe in a binary ring file\n"
+    << "      --log-size <MB>    size of the ring (default 64)\n"
+    << "      --read-log         print the records of probe logs\n"
+    << "      --metrics <[addr:]port> serve OpenMetrics on http://addr:port/metrics\n"
+    << "      --shm <name>       publish live statistics in shared memory, e.g. /ping\n"
+    << "      --shm-keep         leave the segment with the final values at exit\n"
+    << "      --control <path>   run as a daemon taking commands on a Unix socket:\n"
+    << "                         add, remove, tag, list and stats\n"
+    << "      --max-targets <n>  targets a daemon may add, or a state file has\n"
+    << "                         room for (default 1024)\n"
+    << "      --state <file>     keep statistics and timeouts in a file mapped\n"
+    << "                         into memory, resume from it after a restart\n"
+    << "      --summary <s>      instead of a line per probe, a line per target\n"
+    << "                         and group every interval: sent, received, loss\n"
+    << "                         and min/p50/p99/max\n"
+    << "      --summary-groups   only the groups and the total in the summaries\n"
+    << "      --sink <lib.so>    hand the results in batches to a sink library\n"
+    << "      --sink-config <s>  configuration string of the sink\n"
+    << "      --names            print the names of the reply sources, looked up\n"
+    << "                         in the background\n"
+    << "      --names-size <n>   addresses whose names are kept (default 4096)\n"
+    << "      --names-ttl <s>    seconds a name is kept (default 300)\n"
+    << "  a host may carry group labels, host@label[,label...], where a label\n"
+    << "  eu/fra puts the target in the groups eu and eu/fra\n";
+}
+
+// Return false if the command line is invalid
+bool parse_options(int argc, char* argv[], options& opts) {
+  enum {
+    opt_rto_min = 256, opt_rto_max, opt_schedule, opt_jitter, opt_seed,
+    opt_window, opt_align, opt_timestamp, opt_windows, opt_export, opt_merge,
+    opt_series, opt_series_out, opt_rule, opt_group_subnet,
+    opt_changes, opt_format, opt_log, opt_log_size, opt_read_log,
+    opt_metrics, opt_shm, opt_shm_keep, opt_control, opt_max_targets, opt_state,
+    opt_summary, opt_summary_groups, opt_sink, opt_sink_config,
+    opt_names, opt_names_size, opt_names_ttl
+  };
+  static const option long_options[] = {
+    {"interval", required_argument, nullptr, 'i'},
+    {"rto-min",  required_argument, nullptr, opt_rto_min},
+    {"rto-max",  required_argument, nullptr, opt_rto_max},
+    {"schedule", required_argument, nullptr, opt_schedule},
+    {"jitter",   required_argument, nullptr, opt_jitter},
+    {"seed",     required_argument, nullptr, opt_seed},
+    {"window",   required_argument, nullptr, opt_window},
+    {"align",    required_argument, nullptr, opt_align},
+    {"timestamp", no_argument,      nullptr, opt_timestamp},
+    {"burst",    required_argument, nullptr, 'b'},
+    {"size",     required_argument, nullptr, 's'},
+    {"windows",  no_argument,       nullptr, opt_windows},
+    {"export",   required_argument, nullptr, opt_export},
+    {"merge",    no_argument,       nullptr, opt_merge},
+    {"series",   required_argument, nullptr, opt_series},
+    {"series-out", required_argument, nullptr, opt_series_out},
+    {"rule",     required_argument, nullptr, opt_rule},
+    {"group-subnet", required_argument, nullptr, opt_group_subnet},
+    {"changes",  no_argument,       nullptr, opt_changes},
+    {"format",   required_argument, nullptr, opt_format},
+    {"log",      required_argument, nullptr, opt_log},
+    {"log-size", required_argument, nullptr, opt_log_size},
+    {"read-log", no_argument,       nullptr, opt_read_log},
+    {"metrics",  required_argument, nullptr, opt_metrics},
+    {"shm",      required_argument, nullptr, opt_shm},
+    {"shm-keep", no_argument,       nullptr, opt_shm_keep},
+    {"control",  required_argument, nullptr, opt_control},
+    {"max-targets", required_argument, nullptr, opt_max_targets},
+    {"state",    required_argument, nullptr, opt_state},
+    {"summary",  required_argument, nullptr, opt_summary},
+    {"summary-groups", no_argument, nullptr, opt_summary_groups},
+    {"sink",     required_argument, nullptr, opt_sink},
+    {"sink-config", required_argument, nullptr, opt_sink_config},
+    {"names",    no_argument,       nullptr, opt_names},
+    {"names-size", required_argument, nullptr, opt_names_size},
+    {"names-ttl", required_argument, nullptr, opt_names_ttl},
+    {nullptr, 0, nullptr, 0}
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "i:b:s:", long_options, nullptr)) != -1) {
+    switch (c) {
+      case 'i': opts.interval = parse_duration(optarg, 1e6); break;
+      case opt_rto_min: opts.rto_min = parse_duration(optarg, 1e3); break;
+      case opt_rto_max: opts.rto_max = parse_duration(optarg, 1e3); break;
+      case opt_schedule:
+        opts.open_loop = true;
+        if (!strcmp(optarg, "fixed")) opts.schedule = probe_schedule::fixed;
+        else if (!strcmp(optarg, "poisson")) opts.schedule = probe_schedule::poisson;
+        else if (!strcmp(optarg, "uniform")) opts.schedule = probe_schedule::uniform;
+        else return false;
+        break;
+      case opt_jitter: opts.jitter = std::stod(optarg); break;
+      case opt_seed: opts.seed = std::stoull(optarg); break;
+      case opt_window:
+        // Round up to a power of two, the slot is the masked sequence number
+        opts.window = 1;
+        while (opts.window < std::min<unsigned long>(std::stoul(optarg), 65536))
+          opts.window <<= 1;
+        break;
+      case opt_align: opts.align = parse_duration(optarg, 1e3); break;
+      case opt_timestamp: opts.timestamp = true; break;
+      case 'b': opts.burst = std::min(std::max(1ul, std::stoul(optarg)), 1024ul); break;
+      case opt_windows: opts.windows = true; break;
+      case opt_export: opts.export_file = optarg; break;
+      case opt_merge: opts.merge = true; break;
+      case opt_series: opts.series = std::stod(optarg) * (1 << 20); break;
+      case opt_series_out: opts.series_file = optarg; break;
+      case opt_rule: opts.rules.push_back(sla_rule::parse(optarg)); break;
+      case opt_group_subnet: opts.subnet = std::min(std::max(std::stoi(optarg), 0), 32); break;
+      case opt_changes: opts.changes = true; break;
+      case opt_format:
+        if (!strcmp(optarg, "text")) opts.format = record_format::text;
+        else if (!strcmp(optarg, "json")) opts.format = record_format::json;
+        else if (!strcmp(optarg, "csv")) opts.format = record_format::csv;
+        else return false;
+        break;
+      case opt_log: opts.log_file = optarg; break;
+      case opt_log_size: opts.log_size = std::stod(optarg) * (1 << 20); break;
+      case opt_read_log: opts.read_log = true; break;
+      case opt_metrics: {
+        std::string arg = optarg;
+        std::size_t colon = arg.rfind(':');
+        if (colon != std::string::npos)
+          opts.metrics_address = arg.substr(0, colon);
+        opts.metrics_port = std::stoi(arg.substr(colon == std::string::npos ? 0 : colon + 1));
+        break;
+      }
+      case opt_shm: opts.shm_name = optarg; break;
+      case opt_shm_keep: opts.shm_keep = true; break;
+      case opt_control: opts.control = optarg; break;
+      case opt_max_targets: opts.max_targets = std::max(1ul, std::stoul(optarg)); break;
+      case opt_state: opts.state_file = optarg; break;
+      case opt_summary: opts.summary = parse_duration(optarg, 1e6); break;
+      case opt_summary_groups: opts.summary_groups = true; break;
+      case opt_sink: opts.sink = optarg; break;
+      case opt_sink_config: opts.sink_config = optarg; break;
+      case opt_names: opts.names = true; break;
+      case opt_names_size: opts.names_size = std::max(1ul, std::stoul(optarg)); break;
+      case opt_names_ttl: opts.names_ttl = std::stol(optarg); break;
+      case 's': opts.size = std::min(std::stoul(optarg), 65507ul - 8); break;
+      default: return false;
+    }
+  }
+  for (int i = optind; i < argc; ++i)
+    opts.hosts.emplace_back(argv[i]);
+  // By default twice the probes which may be in flight: a round without a
+  // schedule, the rounds sent within the longest timeout with one. A whole
+  // train must fit in any window.
+  std::size_t in_flight = opts.burst;
+  if (opts.window == 0) {
+    if (opts.open_loop) {
+      std::int64_t interval = std::max<std::int64_t>(opts.interval.total_microseconds(), 1);
+      in_flight *= (opts.rto_max.total_microseconds() + interval - 1) / interval;
+    }
+    opts.window = 16;
+  }
+  while (opts.window < in_flight * 2 && opts.window < 65536)
+    opts.window <<= 1;
+  return !opts.hosts.empty() || !opts.control.empty();
+}
+
 }
 
 int main(int argc, char* argv[]) {
   try {
-    if (argc != 2) {
-      std::cerr << "Usage: ping <host>" << std::endl;
+    nettool::options opts;
+    if (!nettool::parse_options(argc, argv, opts)) {
+      nettool::usage();
       return 1;
     }
+    if (opts.merge)
+      return nettool::merge_files(opts);
+    if (opts.read_log)
+      return nettool::read_log(opts);
 
     error_code ec;
     asio::io_service io_service;
-    nettool::pinger p(io_service, argv[1]);
+    nettool::pinger p(io_service, opts);
+    p.start();
     io_service.run(ec);
   } catch (std::exception& e) {
     std::cerr << "Exception: " << e.what() << std::endl;
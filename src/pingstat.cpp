@@ -0,0 +1,133 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+
+#include "output.hpp"
+#include "shm.hpp"
+
+// Print the live statistics a ping started with --shm publishes, without
+// disturbing it: the segment is only read, every entry through its seqlock.
+
+namespace nettool {
+
+struct options {
+  std::string name;
+  double interval = 0;
+  long count = 1;
+};
+
+void usage() {
+  std::cerr << "Usage: pingstat [options] <name>\n"
+    << "  -i, --interval <s>  read again every interval (default once)\n"
+    << "  -n, --count <n>     number of reads with an interval (default until\n"
+    << "                      interrupted)\n"
+    << "  -q, --quiet         only count the reads, to poll fast\n";
+}
+
+std::uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// One consistent entry per target. An entry is only ever seen as a whole,
+// so every probe resolved is counted as sent: received + lost <= sent.
+// Return the number of entries breaking that, which should stay zero.
+std::uint64_t read_all(const shm_stats& shm, std::vector<shm_entry>& entries,
+    std::uint64_t& retries, std::uint64_t& failed) {
+  std::uint64_t broken = 0;
+  entries.resize(shm.targets());
+  for (std::size_t id = 0; id < shm.targets(); ++id) {
+    if (!shm.read(id, entries[id], retries)) {
+      ++failed;
+      continue;
+    }
+    const shm_entry& e = entries[id];
+    broken += e.received + e.lost > e.sent;
+  }
+  return broken;
+}
+
+void print(output& out, const shm_stats& shm, const std::vector<shm_entry>& entries) {
+  std::uint64_t now = now_ns();
+  out.print(FMT_COMPILE("{:<24} {:>15} {:>8} {:>8} {:>6} {:>7} {:>9} {:>9} {:>27} {:>7}\n"),
+      "host", "address", "sent", "received", "lost", "loss", "last ms", "srtt ms",
+      "rtt min/avg/max ms", "age s");
+  for (std::size_t id = 0; id < entries.size(); ++id) {
+    // Slots of targets a daemon has not added yet, or removed, have no name
+    if (shm.host(id).empty()) continue;
+    const shm_entry& e = entries[id];
+    std::string rtt = fmt::format(FMT_COMPILE("{:.3f}/{:.3f}/{:.3f}"),
+        e.rtt_min / 1e6, e.rtt_mean / 1e6, e.rtt_max / 1e6);
+    out.print(FMT_COMPILE("{:<24} {:>15} {:>8} {:>8} {:>6} {:>6.2f}% {:>9.3f} {:>9.3f} {:>27} {:>7.1f}\n"),
+        shm.host(id), shm.address(id), e.sent, e.received, e.lost,
+        e.sent ? 100.0 * e.lost / e.sent : 0.0, e.last_rtt / 1e6, e.srtt / 1e6, rtt,
+        e.updated && now > e.updated ? (now - e.updated) / 1e9 : 0.0);
+  }
+}
+
+volatile sig_atomic_t interrupted = 0;
+
+}
+
+int main(int argc, char* argv[]) {
+  using namespace nettool;
+  static const option long_options[] = {
+    {"interval", required_argument, nullptr, 'i'},
+    {"count",    required_argument, nullptr, 'n'},
+    {"quiet",    no_argument,       nullptr, 'q'},
+    {nullptr, 0, nullptr, 0}
+  };
+  options opts;
+  bool quiet = false;
+  int c;
+  try {
+    while ((c = getopt_long(argc, argv, "i:n:q", long_options, nullptr)) != -1) {
+      switch (c) {
+        case 'i': opts.interval = std::stod(optarg); opts.count = 0; break;
+        case 'n': opts.count = std::stol(optarg); break;
+        case 'q': quiet = true; break;
+        default: usage(); return 1;
+      }
+    }
+    if (optind + 1 != argc) {
+      usage();
+      return 1;
+    }
+    opts.name = argv[optind];
+
+    shm_stats shm(opts.name);
+    signal(SIGINT, [](int) { interrupted = 1; });
+    output out;
+    std::vector<shm_entry> entries;
+    std::uint64_t reads = 0, retries = 0, failed = 0, broken = 0;
+    auto next = std::chrono::steady_clock::now();
+    while (!interrupted && (opts.count == 0 || reads < static_cast<std::uint64_t>(opts.count))) {
+      broken += read_all(shm, entries, retries, failed);
+      ++reads;
+      if (!quiet) {
+        if (reads > 1) out.print(FMT_COMPILE("\n"));
+        print(out, shm, entries);
+        out.flush();
+      }
+      if (opts.interval <= 0) break;
+      next += std::chrono::microseconds(static_cast<long>(opts.interval * 1e6));
+      std::this_thread::sleep_until(next);
+    }
+    out.print(FMT_COMPILE("{} reads of {} targets from pid {}, {} retries, {} failed, {} inconsistent\n"),
+        reads, shm.targets(), shm.pid(), retries, failed, broken);
+    out.flush();
+    return failed || broken ? 2 : 0;
+  } catch (std::exception& e) {
+    std::cerr << "Exception: " << e.what() << std::endl;
+    return 1;
+  }
+}
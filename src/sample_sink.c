@@ -0,0 +1,118 @@
+/*
+ * A sample result sink. Batches are queued by consume() and handled by a
+ * thread of the sink, which counts the outcomes and, if the config names a
+ * file, writes a line per result to it before it releases the batch:
+ *
+ *   ping --sink libsample_sink.so --sink-config results.txt ...
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sink.h"
+
+/* More than the batches ping has, so consume() never waits */
+#define QUEUE_SIZE 64
+
+struct sample_sink {
+  const struct nettool_host* host;
+  FILE* out;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  const struct nettool_batch* queue[QUEUE_SIZE];
+  unsigned head, tail;
+  int closing;
+  uint64_t batches, results, replies, timeouts, errors, dropped;
+};
+
+static void handle(struct sample_sink* s, const struct nettool_batch* b) {
+  static const char* const outcomes[] = {"reply", "timeout", "error"};
+  uint32_t i;
+  ++s->batches;
+  s->results += b->count;
+  s->dropped += b->dropped;
+  for (i = 0; i < b->count; ++i) {
+    const struct nettool_result* r = &b->results[i];
+    s->replies += r->outcome == NETTOOL_REPLY;
+    s->timeouts += r->outcome == NETTOOL_TIMEOUT;
+    s->errors += r->outcome == NETTOOL_ERROR;
+    if (s->out) {
+      const struct nettool_target* t = &s->host->targets[r->target];
+      fprintf(s->out, "%s %s %u %s %.3f\n", t->host, t->address, r->sequence,
+          outcomes[r->outcome < 3 ? r->outcome : 2], r->rtt / 1e6);
+    }
+  }
+  s->host->release(s->host, b);
+}
+
+static void* run(void* arg) {
+  struct sample_sink* s = arg;
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    while (s->head == s->tail && !s->closing)
+      pthread_cond_wait(&s->ready, &s->lock);
+    if (s->head == s->tail)
+      break;
+    const struct nettool_batch* b = s->queue[s->tail++ % QUEUE_SIZE];
+    pthread_mutex_unlock(&s->lock);
+    handle(s, b);
+    pthread_mutex_lock(&s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+static void* sample_open(const struct nettool_host* host, const char* config) {
+  struct sample_sink* s = calloc(1, sizeof(*s));
+  if (!s)
+    return NULL;
+  s->host = host;
+  if (config[0] && !(s->out = fopen(config, "w"))) {
+    perror(config);
+    free(s);
+    return NULL;
+  }
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->ready, NULL);
+  if (pthread_create(&s->thread, NULL, run, s) != 0) {
+    if (s->out)
+      fclose(s->out);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+static void sample_consume(void* sink, const struct nettool_batch* batch) {
+  struct sample_sink* s = sink;
+  pthread_mutex_lock(&s->lock);
+  s->queue[s->head++ % QUEUE_SIZE] = batch;
+  pthread_cond_signal(&s->ready);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void sample_close(void* sink) {
+  struct sample_sink* s = sink;
+  pthread_mutex_lock(&s->lock);
+  s->closing = 1;
+  pthread_cond_signal(&s->ready);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+  fprintf(stderr, "sample sink: %llu batches, %llu results, %llu replies, %llu timeouts, "
+      "%llu errors, %llu dropped\n",
+      (unsigned long long)s->batches, (unsigned long long)s->results,
+      (unsigned long long)s->replies, (unsigned long long)s->timeouts,
+      (unsigned long long)s->errors, (unsigned long long)s->dropped);
+  if (s->out)
+    fclose(s->out);
+  pthread_cond_destroy(&s->ready);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+}
+
+const struct nettool_sink nettool_sink = {
+  NETTOOL_SINK_ABI_VERSION, "sample", sample_open, sample_consume, sample_close
+};
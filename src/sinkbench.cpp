@@ -0,0 +1,115 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <getopt.h>
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+
+#include "output.hpp"
+#include "sink.hpp"
+
+// Push synthetic probe results through a result sink the way ping does, to
+// measure what the sink sustains: one thread appends, the sink releases.
+
+namespace nettool {
+
+struct options {
+  std::string path;
+  std::string config;
+  std::uint64_t results = 100000000;
+  std::uint32_t targets = 10000;
+  // Wait for a free batch instead of dropping
+  bool wait = false;
+};
+
+void usage() {
+  std::cerr << "Usage: sinkbench [options] <sink.so>\n"
+    << "  -n, --results <n>   results to append (default 100000000)\n"
+    << "  -t, --targets <n>   targets they are spread over (default 10000)\n"
+    << "  -c, --config <s>    configuration of the sink\n"
+    << "  -w, --wait          wait for the sink rather than drop results\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  using namespace nettool;
+  static const option long_options[] = {
+    {"results", required_argument, nullptr, 'n'},
+    {"targets", required_argument, nullptr, 't'},
+    {"config",  required_argument, nullptr, 'c'},
+    {"wait",    no_argument,       nullptr, 'w'},
+    {nullptr, 0, nullptr, 0}
+  };
+  options opts;
+  int c;
+  try {
+    while ((c = getopt_long(argc, argv, "n:t:c:w", long_options, nullptr)) != -1) {
+      switch (c) {
+        case 'n': opts.results = std::stod(optarg); break;
+        case 't': opts.targets = std::max(1ul, std::stoul(optarg)); break;
+        case 'c': opts.config = optarg; break;
+        case 'w': opts.wait = true; break;
+        default: usage(); return 1;
+      }
+    }
+    if (optind + 1 != argc) {
+      usage();
+      return 1;
+    }
+    opts.path = argv[optind];
+
+    std::unique_ptr<result_sink> sink(new result_sink(opts.path, opts.config, opts.targets));
+    for (std::uint32_t id = 0; id < opts.targets; ++id) {
+      std::uint32_t address = 0x0A000000 + id;
+      sink->set_target(id, fmt::format(FMT_COMPILE("target{}"), id),
+          fmt::format(FMT_COMPILE("{}.{}.{}.{}"), address >> 24, (address >> 16) & 0xFF,
+            (address >> 8) & 0xFF, address & 0xFF));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t waits = 0;
+    nettool_result r = {};
+    r.ttl = 64;
+    r.bytes = 64;
+    for (std::uint64_t i = 0; i < opts.results; ++i) {
+      r.target = i % opts.targets;
+      r.address = 0x0A000000 + r.target;
+      r.sequence = i / opts.targets;
+      r.sent = 1700000000000000000ull + i * 1000;
+      // One probe in a hundred times out
+      r.outcome = i % 100 == 0 ? NETTOOL_TIMEOUT : NETTOOL_REPLY;
+      r.rtt = r.outcome == NETTOOL_REPLY ? 20000000 + i % 1000000 : 0;
+      if (opts.wait) {
+        for (; !sink->ready(); ++waits)
+          std::this_thread::yield();
+      }
+      sink->append(r);
+    }
+    sink->flush();
+    auto appended = std::chrono::steady_clock::now();
+    std::uint64_t batches = sink->batches(), dropped = sink->dropped();
+    std::string name = sink->name();
+    // Waits for the last batches and closes the sink
+    sink.reset();
+    auto end = std::chrono::steady_clock::now();
+
+    double append_s = std::chrono::duration<double>(appended - start).count();
+    double total_s = std::chrono::duration<double>(end - start).count();
+    output out;
+    out.print(FMT_COMPILE("sink {}: {} results over {} targets in {} batches of {}\n"
+          "append {:.2f} ns/result, end to end {:.3f} s, {:.1f} M results/s, {:.2f} GB/s\n"
+          "{} dropped, {} waits for a batch\n"),
+        name, opts.results, opts.targets, batches, +result_sink::batch_results,
+        append_s * 1e9 / opts.results, total_s, (opts.results - dropped) / total_s / 1e6,
+        (opts.results - dropped) * sizeof(nettool_result) / total_s / 1e9, dropped, waits);
+    out.flush();
+    return 0;
+  } catch (std::exception& e) {
+    std::cerr << "Exception: " << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,174 @@
+// The probe log ring read back: records oldest first across the wrap of the
+// ring, the cursor as written, a reader which falls behind the writer skips
+// the slots overwritten under it, and a reader next to a running writer never
+// sees a torn record.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "probelog.hpp"
+
+namespace {
+
+using nettool::probe_entry;
+using nettool::probe_log;
+using nettool::probe_log_reader;
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAIL %s\n", what);
+    ++failures;
+  }
+}
+
+std::string path() {
+  return "/tmp/probelog_test." + std::to_string(::getpid());
+}
+
+// Record n, every field derived from n so a torn one shows
+probe_entry entry(std::uint64_t n, std::uint32_t targets) {
+  probe_entry e;
+  e.tx = n;
+  e.rx = ~n;
+  e.target = static_cast<std::uint32_t>(n % targets);
+  e.seq = static_cast<std::uint16_t>(n);
+  e.outcome = static_cast<std::uint8_t>(n % 3);
+  e.ttl = static_cast<std::uint8_t>(n >> 8);
+  return e;
+}
+
+bool consistent(const probe_entry& e, std::uint32_t targets) {
+  probe_entry x = entry(e.tx, targets);
+  return e.rx == x.rx && e.target == x.target && e.seq == x.seq && e.outcome == x.outcome && e.ttl == x.ttl;
+}
+
+std::vector<std::uint64_t> read(const probe_log_reader& r, std::uint64_t& skipped) {
+  std::vector<std::uint64_t> v;
+  skipped = r.for_each([&](const probe_entry& e) { v.push_back(e.tx); });
+  return v;
+}
+
+// Before and after the ring wraps: all records, then the newest capacity - 1,
+// the slot under the cursor being the one a crash may have torn
+void wrap() {
+  probe_log log(path(), 64 * sizeof(probe_entry), 4, 7);
+  check(log.capacity() == 64, "capacity");
+  log.set_name(0, "a.example", "192.0.2.1");
+  log.set_name(1, "b.example", "192.0.2.2");
+  for (std::uint64_t n = 0; n < 10; ++n)
+    log.append(entry(n, 2));
+
+  probe_log_reader r(path());
+  check(r.capacity() == 64 && r.created() == 7 && r.written() == 10, "header");
+  check(r.targets().size() == 4 && r.targets()[1].host == "b.example" && r.targets()[1].address == "192.0.2.2"
+      && r.targets()[2].host.empty(), "names");
+  std::uint64_t skipped;
+  std::vector<std::uint64_t> v = read(r, skipped);
+  bool all = v.size() == 10 && skipped == 0;
+  for (std::uint64_t n = 0; all && n < v.size(); ++n) all = v[n] == n;
+  check(all, "before the wrap");
+
+  // The reader maps the same pages, it sees the writer go on
+  for (std::uint64_t n = 10; n < 1000; ++n)
+    log.append(entry(n, 2));
+  check(r.written() == 1000 && log.written() == 1000, "cursor");
+  v = read(r, skipped);
+  bool newest = v.size() == 63 && skipped == 0;
+  for (std::uint64_t i = 0; newest && i < v.size(); ++i) newest = v[i] == 1000 - 63 + i;
+  check(newest, "after the wrap");
+
+  // Records of a target without a slot are left out
+  log.append(entry(1000, 5));
+  log.append(entry(1004, 5));
+  v = read(r, skipped);
+  check(v.size() == 62 && v.back() == 1000, "unknown target");
+}
+
+// The writer laps the reader halfway through: the slots it overwrote are
+// skipped, never delivered as the old or the new record
+void lagging() {
+  probe_log log(path(), 64 * sizeof(probe_entry), 1, 0);
+  for (std::uint64_t n = 0; n < 100; ++n)
+    log.append(entry(n, 1));
+  probe_log_reader r(path());
+  std::vector<std::uint64_t> v;
+  std::uint64_t next = 100;
+  std::uint64_t skipped = r.for_each([&](const probe_entry& e) {
+    v.push_back(e.tx);
+    if (v.size() == 20)
+      for (std::uint64_t end = next + 40; next < end; ++next)
+        log.append(entry(next, 1));
+  });
+  // 37 .. 99 were there, 37 .. 56 read before the writer ran over 37 .. 76
+  bool ordered = v.size() == 20 + 23;
+  for (std::uint64_t i = 0; ordered && i < v.size(); ++i)
+    ordered = v[i] == (i < 20 ? 37 + i : 77 + i - 20);
+  check(ordered, "lagging reader order");
+  check(skipped == 20, "lagging reader skips");
+}
+
+// A writer thread against a reader looping over the ring
+void concurrent() {
+  const std::uint32_t targets = 3;
+  probe_log log(path(), 256 * sizeof(probe_entry), targets, 0);
+  probe_log_reader r(path());
+  std::atomic<bool> done(false);
+  std::thread writer([&] {
+    for (std::uint64_t n = 0; n < 20000000; ++n)
+      log.append(entry(n, targets));
+    done = true;
+  });
+  bool whole = true, ordered = true;
+  std::uint64_t passes = 0, delivered = 0;
+  while (!done) {
+    std::uint64_t last = 0;
+    bool first = true;
+    r.for_each([&](const probe_entry& e) {
+      whole &= consistent(e, targets);
+      ordered &= first || e.tx > last;
+      first = false;
+      last = e.tx;
+      ++delivered;
+    });
+    ++passes;
+  }
+  writer.join();
+  check(whole, "no torn record");
+  check(ordered, "concurrent order");
+  check(passes > 1 && delivered > 0, "reader ran");
+}
+
+void not_a_log() {
+  {
+    probe_log log(path(), 4096, 1, 0);
+  }
+  ::truncate(path().c_str(), 16);
+  bool thrown = false;
+  try {
+    probe_log_reader r(path());
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  check(thrown, "not a probe log");
+}
+
+}
+
+int main() {
+  wrap();
+  lagging();
+  concurrent();
+  not_a_log();
+  ::unlink(path().c_str());
+  if (failures) return 1;
+  std::printf("probelog: ok\n");
+  return 0;
+}
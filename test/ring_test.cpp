@@ -0,0 +1,173 @@
+// Stress of the single producer, single consumer ring and of the sleep and
+// wake handshake of async_writer: every byte arrives once and in order, and
+// a writer which went to sleep is always woken by the next record.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+
+#include "record.hpp"
+#include "ring.hpp"
+
+namespace {
+
+using nettool::async_writer;
+using nettool::spsc_ring;
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAIL %s\n", what);
+    ++failures;
+  }
+}
+
+// Byte i of the stream
+char expected(std::uint64_t i) {
+  return static_cast<char>(i * 31 + (i >> 8));
+}
+
+// Records of 1 to 61 bytes through a ring a little larger than the biggest
+// one, so nearly every record wraps or finds the ring full
+void ring_order() {
+  const std::uint64_t total = 64 << 20;
+  spsc_ring ring(64);
+  std::thread producer([&] {
+    char record[64];
+    std::uint64_t sent = 0;
+    for (std::size_t n = 1; sent < total; n = n % 61 + 1) {
+      n = std::min<std::uint64_t>(n, total - sent);
+      for (std::size_t i = 0; i < n; ++i)
+        record[i] = expected(sent + i);
+      while (!ring.push(record, n))
+        std::this_thread::yield();
+      sent += n;
+    }
+  });
+  std::uint64_t received = 0;
+  bool ordered = true;
+  while (received < total) {
+    const char* p;
+    std::size_t n = ring.peek(p);
+    if (!n) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (std::size_t i = 0; i < n; ++i)
+      ordered &= p[i] == expected(received + i);
+    ring.pop(n);
+    received += n;
+  }
+  producer.join();
+  check(ordered, "ring order");
+  check(received == total && ring.empty(), "ring count");
+}
+
+// Read the pipe until count bytes arrived, false if nothing came for a
+// second: the writer slept with data in its ring
+bool drain(int fd, std::vector<char>& out, std::size_t count) {
+  char buffer[4096];
+  while (out.size() < count) {
+    pollfd pfd = {fd, POLLIN, 0};
+    if (::poll(&pfd, 1, 1000) != 1) return false;
+    ssize_t n = ::read(fd, buffer, std::min(sizeof(buffer), count - out.size()));
+    if (n <= 0) return false;
+    out.insert(out.end(), buffer, buffer + n);
+  }
+  return true;
+}
+
+// One record at a time: the next is only written once the previous one
+// came out of the pipe, so the writer has just found its ring empty and is
+// on its way to sleep. A random spin before the write lands it anywhere on
+// that way. A lost wakeup leaves a record in the ring for good.
+void writer_wakeup() {
+  int fds[2];
+  check(::pipe(fds) == 0, "pipe");
+  const std::uint64_t records = 20000;
+  std::vector<char> out;
+  bool woken = true;
+  {
+    async_writer writer(fds[1], 4096);
+    std::mt19937 rng(1);
+    for (std::uint64_t i = 0; i < records && woken; ++i) {
+      for (volatile unsigned spin = rng() % 4096; spin; spin = spin - 1) {}
+      writer.write(reinterpret_cast<const char*>(&i), sizeof(i));
+      woken = drain(fds[0], out, (i + 1) * sizeof(i));
+      // Now and then leave the writer time to fall asleep for real
+      if (i % 1000 == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    check(writer.dropped() == 0, "writer drops nothing");
+  }
+  check(woken, "writer wakeup");
+  bool ordered = out.size() == records * sizeof(std::uint64_t);
+  for (std::uint64_t i = 0; ordered && i < records; ++i) {
+    std::uint64_t v;
+    std::memcpy(&v, out.data() + i * sizeof(v), sizeof(v));
+    ordered = v == i;
+  }
+  check(ordered, "writer order");
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+// Bursts into a small ring: records which do not fit are dropped and
+// counted, the others arrive in order, and stop() writes what is left
+void writer_bursts() {
+  int fds[2];
+  check(::pipe(fds) == 0, "pipe");
+  const std::uint64_t records = 200000;
+  std::vector<char> out;
+  std::thread reader([&] {
+    char buffer[4096];
+    ssize_t n;
+    while ((n = ::read(fds[0], buffer, sizeof(buffer))) > 0)
+      out.insert(out.end(), buffer, buffer + n);
+  });
+  std::uint64_t dropped;
+  {
+    async_writer writer(fds[1], 256);
+    for (std::uint64_t i = 0; i < records; ++i) {
+      writer.write(reinterpret_cast<const char*>(&i), sizeof(i));
+      if (i % 64 == 0)
+        std::this_thread::yield();
+    }
+    writer.stop();
+    dropped = writer.dropped();
+  }
+  ::close(fds[1]);
+  reader.join();
+  ::close(fds[0]);
+  std::uint64_t count = out.size() / sizeof(std::uint64_t);
+  check(out.size() % sizeof(std::uint64_t) == 0, "bursts whole records");
+  check(count + dropped == records, "bursts count");
+  bool increasing = true;
+  std::uint64_t last = 0;
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::uint64_t v;
+    std::memcpy(&v, out.data() + i * sizeof(v), sizeof(v));
+    increasing &= i == 0 || v > last;
+    last = v;
+  }
+  check(increasing, "bursts order");
+}
+
+}
+
+int main() {
+  ring_order();
+  writer_wakeup();
+  writer_bursts();
+  if (failures) return 1;
+  std::printf("ring: ok\n");
+  return 0;
+}
@@ -0,0 +1,166 @@
+// Round trip of the series encoder: every sample recorded is read back in
+// order within its error bounds, across chunks and targets, a steady path
+// stays within its bit budget, and eviction only drops the oldest samples.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "series.hpp"
+
+namespace {
+
+using nettool::series_store;
+using sample = std::pair<std::int64_t, std::int64_t>;
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAIL %s\n", what);
+    ++failures;
+  }
+}
+
+std::vector<sample> read(const series_store& store, std::size_t id,
+    std::int64_t from = 0, std::int64_t to = INT64_MAX) {
+  std::vector<sample> v;
+  store.query(id, from, to, [&](std::int64_t time, std::int64_t rtt) { v.emplace_back(time, rtt); });
+  return v;
+}
+
+// A time within half a step, a loss as a loss, a round trip time exactly
+// below 128 us and within 0.8% above
+bool close(const sample& stored, const sample& exact) {
+  if (std::abs(stored.first - exact.first) > series_store::time_step / 2) return false;
+  if (exact.second < 0 || stored.second < 0) return stored.second == exact.second;
+  return std::abs(stored.second - exact.second) <= exact.second / 128;
+}
+
+bool close(const std::vector<sample>& stored, const std::vector<sample>& exact) {
+  if (stored.size() != exact.size()) return false;
+  for (std::size_t i = 0; i < stored.size(); ++i)
+    if (!close(stored[i], exact[i])) return false;
+  return true;
+}
+
+// Send times on a 1 s schedule with timer jitter, now and then a pause or a
+// step back of the clock; round trip times steady, jumping or lost
+std::vector<sample> generate(std::mt19937_64& rng, std::size_t n) {
+  std::vector<sample> v;
+  std::int64_t time = 1700000000000000;
+  std::int64_t rtt = 20000;
+  for (std::size_t i = 0; i < n; ++i) {
+    switch (rng() % 50) {
+      case 0: time += 3600000000; break;
+      case 1: time += 400000000; break;
+      case 2: time -= 2000000; break;
+      default: time += 1000000 + static_cast<std::int64_t>(rng() % 200) - 100;
+    }
+    std::int64_t r;
+    switch (rng() % 20) {
+      case 0: r = -1; break;
+      case 1: rtt = rng() % 2000000; r = rtt; break;
+      case 2: r = rng() % 100; break;
+      case 3: r = rtt + 40000; break;
+      default: rtt = std::max<std::int64_t>(rtt + static_cast<std::int64_t>(rng() % 21) - 10, 0); r = rtt;
+    }
+    v.emplace_back(time, r);
+  }
+  return v;
+}
+
+void round_trip() {
+  std::mt19937_64 rng(1);
+  const std::size_t targets = 3, n = 20000;
+  series_store store(std::size_t(1) << 30);
+  std::vector<std::vector<sample>> expected;
+  for (std::size_t id = 0; id < targets; ++id) {
+    store.add();
+    expected.push_back(generate(rng, n));
+  }
+  // Interleaved, as the targets of a run are
+  for (std::size_t i = 0; i < n; ++i)
+    for (std::size_t id = 0; id < targets; ++id)
+      store.record(id, expected[id][i].first, expected[id][i].second);
+  for (std::size_t id = 0; id < targets; ++id) {
+    check(store.recorded(id) == n && store.stored(id) == n, "round trip count");
+    check(close(read(store, id), expected[id]), "round trip samples");
+  }
+  check(store.evicted() == 0, "round trip evicts nothing");
+  check(store.bytes() > series_store::chunk_bytes * targets, "round trip spans chunks");
+
+  // A time range is the samples stored in [from, to)
+  std::vector<sample> all = read(store, 0);
+  std::int64_t from = all[n / 3].first, to = all[n / 2].first;
+  std::vector<sample> range;
+  for (const sample& s : all)
+    if (s.first >= from && s.first < to) range.push_back(s);
+  check(read(store, 0, from, to) == range, "range");
+}
+
+void extremes() {
+  series_store store(std::size_t(1) << 20);
+  store.add();
+  std::vector<sample> v = {
+    {0, 0}, {1, 0xfffffffe}, {2, -1}, {3, 0}, {4, -1}, {INT64_C(1) << 40, 1},
+    {(INT64_C(1) << 40) + 1, 65536}, {(INT64_C(1) << 40) + 2, 127}, {(INT64_C(1) << 40) + 3, 128}
+  };
+  for (const sample& s : v)
+    store.record(0, s.first, s.second);
+  check(close(read(store, 0), v), "extreme values");
+}
+
+// A day of 1 Hz probes of 10k targets in a few hundred MB for a steady path
+// over the internet, 20 ms with 0.2 ms of noise and 100 us of timer jitter;
+// loopback, 50 us with 10 us of noise over buckets of 1 us, within 11 bits
+void budget() {
+  std::mt19937_64 rng(3);
+  std::normal_distribution<double> noise(0, 1);
+  const std::size_t n = 100000;
+  const double rtts[] = {20000, 50}, spreads[] = {200, 10}, limits[] = {500, 1133};
+  for (int path = 0; path < 2; ++path) {
+    series_store store(std::size_t(1) << 30);
+    store.add();
+    std::int64_t time = 1700000000000000;
+    for (std::size_t i = 0; i < n; ++i) {
+      time += 1000000 + static_cast<std::int64_t>(rng() % 100);
+      double rtt = rtts[path] + spreads[path] * noise(rng);
+      store.record(0, time, i % 1000 == 0 ? -1 : std::max<std::int64_t>(std::lround(rtt), 0));
+    }
+    double bits = static_cast<double>(store.bits(0)) / n;
+    double day = bits * 86400 * 10000 / 8 / (1 << 20);
+    std::printf("series: path %d, %.2f bits per sample, a day of 10k targets %.0f MB\n", path, bits, day);
+    check(day < limits[path], "budget");
+  }
+}
+
+void eviction() {
+  std::mt19937_64 rng(2);
+  const std::size_t n = 50000;
+  std::vector<sample> v = generate(rng, n);
+  series_store store(16 * series_store::chunk_bytes);
+  store.add();
+  for (const sample& s : v)
+    store.record(0, s.first, s.second);
+  std::vector<sample> kept = read(store, 0);
+  check(store.bytes() <= store.budget(), "within budget");
+  check(kept.size() == store.stored(0) && store.evicted() == n - kept.size(), "evicted count");
+  check(!kept.empty() && kept.size() < n, "some evicted");
+  check(close(kept, std::vector<sample>(v.end() - kept.size(), v.end())), "newest kept");
+}
+
+}
+
+int main() {
+  round_trip();
+  extremes();
+  budget();
+  eviction();
+  if (failures) return 1;
+  std::printf("series: ok\n");
+  return 0;
+}